@@ -18,6 +18,7 @@
 #include "fbx/Fbx2Raw.hpp"
 #include "gltf/Raw2Gltf.hpp"
 #include "utils/File_Utils.hpp"
+#include "utils/Image_Utils.hpp"
 #include "utils/String_Utils.hpp"
 
 bool verboseOutput = false;
@@ -121,6 +122,55 @@ int main(int argc, char* argv[]) {
          "Select baked animation framerate.")
       ->type_name("(bake24|bake30|bake60)");
 
+  app.add_option(
+         "--anim-cache-budget",
+         gltfOptions.animationCacheMegabytes,
+         "How many megabytes of node transforms to cache while baking animations (0: no limit). "
+         "Beyond it, node-by-node baking mostly re-evaluates; see --anim-frame-major.",
+         true)
+      ->check(CLI::Range(0, 1 << 20))
+      ->type_name("MB");
+
+  app.add_flag(
+      "--anim-frame-major",
+      gltfOptions.animationFrameMajor,
+      "Bake animations frame by frame rather than node by node; uses less memory for deep rigs.");
+
+  app.add_flag(
+      "--anim-curves",
+      gltfOptions.animationCurves,
+      "Export animation curves as they are, rather than baked, where glTF can express them.");
+
+  app.add_option(
+         "--texture-dir",
+         [&](std::vector<std::string> folders) -> bool {
+           for (const std::string& folder : folders) {
+             gltfOptions.textureSearchRoots.push_back(TextureSearchRoot{folder, false});
+           }
+           return true;
+         },
+         "Also look for texture files in this folder.")
+      ->type_size(-1)
+      ->type_name("FOLDER");
+
+  app.add_option(
+         "--texture-tree",
+         [&](std::vector<std::string> folders) -> bool {
+           for (const std::string& folder : folders) {
+             gltfOptions.textureSearchRoots.push_back(TextureSearchRoot{folder, true});
+           }
+           return true;
+         },
+         "Also look for texture files in this folder and all of its subfolders.")
+      ->type_size(-1)
+      ->type_name("FOLDER");
+
+  app.add_option(
+         "--image-cache",
+         gltfOptions.imagePropertiesCache,
+         "Remember the size and transparency of texture images in this file, across runs.")
+      ->type_name("FILE");
+
   const auto opt_flip_u = app.add_flag("--flip-u", "Flip all U texture coordinates.");
   const auto opt_no_flip_u = app.add_flag("--no-flip-u", "Don't flip U texture coordinates.");
   const auto opt_flip_v = app.add_flag("--flip-v", "Flip all V texture coordinates.");
@@ -148,6 +198,41 @@ int main(int argc, char* argv[]) {
       gltfOptions.enableUserProperties,
       "Transcribe FBX User Properties into glTF node and material 'extras'.");
 
+  app.add_flag_function(
+      "--no-user-properties",
+      [&](size_t count) { gltfOptions.enableUserProperties = (count == 0); },
+      "Don't transcribe FBX User Properties.");
+
+  app.add_flag_function(
+         "--skip-animations",
+         [&](size_t count) { gltfOptions.importScope.animations = (count == 0); },
+         "Don't import animations.")
+      ->group("Import");
+
+  app.add_flag_function(
+         "--skip-materials",
+         [&](size_t count) { gltfOptions.importScope.materials = (count == 0); },
+         "Don't import materials (or textures); all meshes get the default material.")
+      ->group("Import");
+
+  app.add_flag_function(
+         "--skip-textures",
+         [&](size_t count) { gltfOptions.importScope.textures = (count == 0); },
+         "Don't import textures, nor look for their image files.")
+      ->group("Import");
+
+  app.add_flag_function(
+         "--skip-skinning",
+         [&](size_t count) { gltfOptions.importScope.skinning = (count == 0); },
+         "Don't import skinning; meshes are exported in their bind pose.")
+      ->group("Import");
+
+  app.add_flag_function(
+         "--skip-blend-shapes",
+         [&](size_t count) { gltfOptions.importScope.blendShapes = (count == 0); },
+         "Don't import blend shapes.")
+      ->group("Import");
+
   app.add_flag(
       "--blend-shape-no-sparse",
       gltfOptions.disableSparseBlendShapes,
@@ -264,6 +349,77 @@ int main(int argc, char* argv[]) {
       ->check(CLI::Range(1, 32))
       ->group("Draco");
 
+  app.add_flag(
+         "--anim-reduce",
+         gltfOptions.animationReduction.enabled,
+         "Drop baked animation samples that interpolation reproduces within tolerance. With "
+         "--anim-adaptive-rate, each pass gets half the tolerance.")
+      ->group("Animation reduction");
+
+  app.add_option(
+         "--anim-reduce-position",
+         gltfOptions.animationReduction.positionTolerance,
+         "How far, in output units, reduced translations may stray from the baked ones.",
+         true)
+      ->check(CLI::Range(0.0, 1e6))
+      ->group("Animation reduction");
+
+  app.add_option(
+         "--anim-reduce-angle",
+         gltfOptions.animationReduction.angleTolerance,
+         "How far, in degrees, reduced rotations may stray from the baked ones.",
+         true)
+      ->check(CLI::Range(0.0, 180.0))
+      ->group("Animation reduction");
+
+  app.add_option(
+         "--anim-reduce-scale",
+         gltfOptions.animationReduction.scaleTolerance,
+         "How far reduced scales may stray from the baked ones.",
+         true)
+      ->check(CLI::Range(0.0, 1e6))
+      ->group("Animation reduction");
+
+  app.add_flag(
+         "--anim-drop-constant",
+         gltfOptions.animationReduction.dropConstantTracks,
+         "Drop animation tracks that hold a node's rest pose, or one every animation agrees on. "
+         "The rest pose of skin joints and their ancestors is never changed.")
+      ->group("Animation reduction");
+
+  app.add_flag(
+         "--anim-adaptive-rate",
+         gltfOptions.animationReduction.adaptiveRate,
+         "Sample each animation track at the lowest whole frame rate, dividing --anim-framerate, "
+         "that interpolates back to the baked samples within tolerance. With --anim-reduce, "
+         "each pass gets half the tolerance.")
+      ->group("Animation reduction");
+
+  app.add_flag(
+         "--anim-quantize",
+         gltfOptions.animationQuantization.enabled,
+         "Write animated rotations and blend shape weights as normalized integers.")
+      ->group("Animation reduction");
+
+  app.add_option(
+         "--anim-quantize-weights",
+         [&](std::vector<std::string> choices) -> bool {
+           for (const std::string& choice : choices) {
+             if (choice == "8") {
+               gltfOptions.animationQuantization.weightBits = 8;
+             } else if (choice == "16") {
+               gltfOptions.animationQuantization.weightBits = 16;
+             } else {
+               fmt::printf("Unknown --anim-quantize-weights: %s\n", choice);
+               throw CLI::RuntimeError(1);
+             }
+           }
+           return true;
+         },
+         "How many bits to quantize blend shape weights to.")
+      ->type_name("(8|16)")
+      ->group("Animation reduction");
+
   app.add_option(
          "--fbx-temp-dir", gltfOptions.fbxTempDir, "Temporary directory to be used by FBX SDK.")
       ->check(CLI::ExistingDirectory);
@@ -355,6 +511,9 @@ int main(int argc, char* argv[]) {
 
   raw.forceMask = gltfOptions.forceMask;
 
+  if (!gltfOptions.imagePropertiesCache.empty()) {
+    ImageUtils::LoadImagePropertiesCache(gltfOptions.imagePropertiesCache);
+  }
   for (auto inputPath : inputPaths) {
     if (verboseOutput) {
       fmt::printf("Loading FBX File: %s\n", inputPath);
@@ -364,12 +523,37 @@ int main(int argc, char* argv[]) {
       return 1;
     }
   }
+  if (!gltfOptions.imagePropertiesCache.empty()) {
+    ImageUtils::SaveImagePropertiesCache(gltfOptions.imagePropertiesCache);
+  }
 
   if (!texturesTransforms.empty()) {
     raw.TransformTextures(texturesTransforms);
   }
   raw.Condense(gltfOptions.maxSkinningWeights, gltfOptions.normalizeSkinningWeights);
   raw.TransformGeometry(gltfOptions.computeNormals);
+  // key reduction measures its error against the adapted samples, not the baked ones, so when
+  // both run each gets half the tolerance, to keep the sum of their errors within it
+  const auto& reduction = gltfOptions.animationReduction;
+  const float toleranceShare = (reduction.adaptiveRate && reduction.enabled) ? 0.5f : 1.0f;
+  if (reduction.adaptiveRate) {
+    raw.AdaptAnimationRates(
+        reduction.positionTolerance * toleranceShare,
+        reduction.angleTolerance * toleranceShare,
+        reduction.scaleTolerance * toleranceShare);
+  }
+  if (reduction.enabled) {
+    raw.ReduceAnimations(
+        reduction.positionTolerance * toleranceShare,
+        reduction.angleTolerance * toleranceShare,
+        reduction.scaleTolerance * toleranceShare);
+  }
+  if (gltfOptions.animationReduction.dropConstantTracks) {
+    raw.RemoveConstantAnimationTracks(
+        gltfOptions.animationReduction.positionTolerance,
+        gltfOptions.animationReduction.angleTolerance,
+        gltfOptions.animationReduction.scaleTolerance);
+  }
 
   std::ofstream outStream; // note: auto-flushes in destructor
   const auto streamStart = outStream.tellp();
@@ -75,6 +75,14 @@ enum class AnimationFramerateOptions {
   BAKE60, // bake animations at 60 fps
 };
 
+/**
+ * A folder to look for texture files in, optionally including all of its subfolders.
+ */
+struct TextureSearchRoot {
+  std::string folder;
+  bool recursive;
+};
+
 /**
  * User-supplied options that dictate the nature of the glTF being generated.
  */
@@ -107,6 +115,18 @@ struct GltfOptions {
   /** Whether to include FBX User Properties as 'extras' metadata in glTF nodes. */
   bool enableUserProperties{true};
 
+  /**
+   * What to import from the FBX at all. Anything left out is neither loaded by the FBX SDK nor
+   * converted, which can make a large difference to import times.
+   */
+  struct {
+    bool animations = true;
+    bool materials = true;
+    bool textures = true;
+    bool skinning = true;
+    bool blendShapes = true;
+  } importScope;
+
   /** Whether to use KHR_materials_unlit to extend materials definitions. */
   bool useKHRMatUnlit{false};
   /** Whether to populate the pbrMetallicRoughness substruct in materials. */
@@ -131,6 +151,48 @@ struct GltfOptions {
   UseLongIndicesOptions useLongIndices = UseLongIndicesOptions::AUTO;
   /** Select baked animation framerate. */
   AnimationFramerateOptions animationFramerate = AnimationFramerateOptions::BAKE30;
+  /** Roughly how many megabytes of node transforms to cache while baking; 0 for no limit. */
+  int animationCacheMegabytes{2048};
+  /**
+   * Whether to bake animations a frame at a time across all nodes, parents first, rather than one
+   * node at a time; the output is the same, but only one frame of node transforms is ever cached.
+   */
+  bool animationFrameMajor{false};
+  /**
+   * Whether to export translation and scale curves with their own keys and interpolation, rather
+   * than baked, wherever glTF can play them back exactly.
+   */
+  bool animationCurves{false};
+
+  /** Whether and how to drop baked animation samples that interpolation reproduces anyway. */
+  struct {
+    bool enabled = false;
+    float positionTolerance = 0.0005f; // in output units, after scaling
+    float angleTolerance = 0.05f; // degrees
+    float scaleTolerance = 0.0005f;
+    /** Whether to also drop tracks that are constant, within the same tolerances. */
+    bool dropConstantTracks = false;
+    /** Whether to first sample each channel at the lowest rate the same tolerances allow. */
+    bool adaptiveRate = false;
+  } animationReduction;
+
+  /**
+   * Whether to write animated rotations as normalized shorts, and blend shape weights as normalized
+   * unsigned bytes or shorts, rather than as floats.
+   */
+  struct {
+    bool enabled = false;
+    int weightBits = 8; // 8 or 16
+  } animationQuantization;
+
+  /**
+   * Where else to look for texture files, after the FBX's own folder, its .fbm folder and the
+   * working directory. Earlier roots take precedence.
+   */
+  std::vector<TextureSearchRoot> textureSearchRoots;
+
+  /** If set, a file to keep image properties in between runs; see ImageUtils. */
+  std::string imagePropertiesCache;
 
   /** Temporary directory used by FBX SDK. */
   std::string fbxTempDir;
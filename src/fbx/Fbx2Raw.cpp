@@ -10,14 +10,17 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <fstream>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "FBX2glTF.h"
@@ -25,9 +28,11 @@
 #include "raw/RawModel.hpp"
 #include "utils/File_Utils.hpp"
 #include "utils/String_Utils.hpp"
+#include "utils/Thread_Utils.hpp"
 
 #include "FbxBlendShapesAccess.hpp"
 #include "FbxLayerElementAccess.hpp"
+#include "FbxMeshTriangulation.hpp"
 #include "FbxSkinningAccess.hpp"
 #include "materials/RoughnessMetallicMaterials.hpp"
 #include "materials/TraditionalMaterials.hpp"
@@ -108,22 +113,23 @@ static RawMaterialType GetMaterialType(
 }
 
 static void calcMinMax(
-    RawSurface& rawSurface,
+    std::vector<Vec3f>& jointGeometryMins,
+    std::vector<Vec3f>& jointGeometryMaxs,
     const FbxSkinningAccess& skinning,
     const FbxVector4& globalPosition,
-    const std::vector<RawVertexSkinningInfo>& indicesAndWeights) {
+    const RawVertexSkinningArray& indicesAndWeights) {
   for (int i = 0; i < indicesAndWeights.size(); i++) {
     if (indicesAndWeights[i].jointWeight > 0.0f) {
       const FbxVector4 localPosition =
           skinning.GetJointInverseGlobalTransforms(indicesAndWeights[i].jointIndex)
               .MultNormalize(globalPosition);
 
-      Vec3f& mins = rawSurface.jointGeometryMins[indicesAndWeights[i].jointIndex];
+      Vec3f& mins = jointGeometryMins[indicesAndWeights[i].jointIndex];
       mins[0] = std::min(mins[0], (float)localPosition[0]);
       mins[1] = std::min(mins[1], (float)localPosition[1]);
       mins[2] = std::min(mins[2], (float)localPosition[2]);
 
-      Vec3f& maxs = rawSurface.jointGeometryMaxs[indicesAndWeights[i].jointIndex];
+      Vec3f& maxs = jointGeometryMaxs[indicesAndWeights[i].jointIndex];
       maxs[0] = std::max(maxs[0], (float)localPosition[0]);
       maxs[1] = std::max(maxs[1], (float)localPosition[1]);
       maxs[2] = std::max(maxs[2], (float)localPosition[2]);
@@ -131,6 +137,86 @@ static void calcMinMax(
   }
 }
 
+// Skinning only depends on the control point, so resolve it once per control point rather than per
+// polygon corner: returns every control point's influences, strongest first and capped at
+// maxWeights, and grows the surface's joint geometry bounds by the skinned position of each control
+// point the polygons actually use. Control points are split across worker threads, each with its
+// own bounds, which are merged at the end.
+static std::vector<RawVertexSkinningArray> ResolveSkinning(
+    RawSurface& rawSurface,
+    const FbxSkinningAccess& skinning,
+    const FbxMesh* pMesh,
+    const std::vector<FbxVector4>& meshPositions,
+    const size_t maxWeights) {
+  std::vector<RawVertexSkinningArray> meshSkinning(meshPositions.size());
+
+  std::vector<bool> controlPointUsed(meshPositions.size(), false);
+  const int* polygonVertices = pMesh->GetPolygonVertices();
+  for (int i = 0; i < pMesh->GetPolygonVertexCount(); i++) {
+    if (polygonVertices[i] >= 0 && polygonVertices[i] < (int)meshPositions.size()) {
+      controlPointUsed[polygonVertices[i]] = true;
+    }
+  }
+
+  const size_t workerCount = ThreadUtils::GetWorkerCount();
+  std::vector<std::vector<Vec3f>> workerMins(workerCount);
+  std::vector<std::vector<Vec3f>> workerMaxs(workerCount);
+  ThreadUtils::ParallelFor(
+      meshPositions.size(),
+      1024,
+      [&](const size_t begin, const size_t end, const size_t workerIndex) {
+        std::vector<Vec3f>& mins = workerMins[workerIndex];
+        std::vector<Vec3f>& maxs = workerMaxs[workerIndex];
+        mins.assign(rawSurface.jointGeometryMins.size(), Vec3f(FLT_MAX, FLT_MAX, FLT_MAX));
+        maxs.assign(rawSurface.jointGeometryMaxs.size(), Vec3f(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+
+        for (size_t controlPointIndex = begin; controlPointIndex < end; controlPointIndex++) {
+          RawVertexSkinningArray& skinningInfo = meshSkinning[controlPointIndex];
+          for (const FbxVertexSkinningInfo& sourceSkinningInfo :
+               skinning.GetVertexSkinningInfo((int)controlPointIndex)) {
+            skinningInfo.push_back(
+                RawVertexSkinningInfo{sourceSkinningInfo.jointId, sourceSkinningInfo.weight});
+          }
+
+          if (controlPointUsed[controlPointIndex]) {
+            FbxMatrix skinningMatrix = FbxMatrix() * 0.0;
+            for (int j = 0; j < skinningInfo.size(); j++)
+              skinningMatrix += skinning.GetJointSkinningTransform(skinningInfo[j].jointIndex) *
+                  skinningInfo[j].jointWeight;
+
+            const FbxVector4 globalPosition =
+                skinningMatrix.MultNormalize(meshPositions[controlPointIndex]);
+            calcMinMax(mins, maxs, skinning, globalPosition, skinningInfo);
+          }
+
+          // Condense() would drop the weakest influences anyway; doing it here keeps the vertices
+          // within their inline skinning storage.
+          if (skinningInfo.size() > maxWeights) {
+            std::partial_sort(
+                skinningInfo.begin(),
+                skinningInfo.begin() + maxWeights,
+                skinningInfo.end(),
+                std::greater<RawVertexSkinningInfo>());
+            skinningInfo.resize(maxWeights);
+          }
+        }
+      });
+
+  for (size_t workerIndex = 0; workerIndex < workerCount; workerIndex++) {
+    for (size_t jointIndex = 0; jointIndex < workerMins[workerIndex].size(); jointIndex++) {
+      const Vec3f& workerMin = workerMins[workerIndex][jointIndex];
+      const Vec3f& workerMax = workerMaxs[workerIndex][jointIndex];
+      Vec3f& mins = rawSurface.jointGeometryMins[jointIndex];
+      Vec3f& maxs = rawSurface.jointGeometryMaxs[jointIndex];
+      for (int axis = 0; axis < 3; axis++) {
+        mins[axis] = std::min(mins[axis], workerMin[axis]);
+        maxs[axis] = std::max(maxs[axis], workerMax[axis]);
+      }
+    }
+  }
+  return meshSkinning;
+}
+
 static std::vector<std::string> split(const std::string& str, const std::string& delimiter) {
   std::string s = str;
   std::vector<std::string> result;
@@ -207,20 +293,311 @@ static void maybeAddOwtTexture(
     }
   }
 }
+
+// Resolves a mesh layer into one value per element it maps to (see
+// FbxLayerElementAccess::GetSourceIndex), converted by 'convert'; empty if the layer is absent.
+template <typename _vec_, typename _type_, typename _convert_>
+static std::vector<_vec_> ResolveLayer(
+    const FbxLayerElementAccess<_type_>& layer,
+    const _convert_& convert) {
+  std::vector<_vec_> values;
+  if (layer.LayerPresent()) {
+    values.resize(std::max(0, layer.GetSourceCount()));
+    for (int sourceIndex = 0; sourceIndex < (int)values.size(); sourceIndex++) {
+      values[sourceIndex] = convert(layer.GetSourceElement(sourceIndex));
+    }
+  }
+  return values;
+}
+
+template <typename _vec_, typename _type_>
+static _vec_ GatherLayer(
+    const FbxLayerElementAccess<_type_>& layer,
+    const std::vector<_vec_>& values,
+    const int polygonIndex,
+    const int polygonVertexIndex,
+    const int controlPointIndex,
+    const _vec_& defaultValue) {
+  if (!layer.LayerPresent()) {
+    return defaultValue;
+  }
+  const int sourceIndex = layer.GetSourceIndex(polygonIndex, polygonVertexIndex, controlPointIndex);
+  return (sourceIndex >= 0 && sourceIndex < (int)values.size()) ? values[sourceIndex]
+                                                                 : defaultValue;
+}
+
+// The morph deltas of one polygon corner, as (target shape index, delta) for every target shape
+// that actually moves it.
+typedef std::vector<std::pair<int, RawBlendVertex>> BlendCornerDeltas;
+
+static void ComputeBlendDeltas(
+    const std::vector<const FbxBlendShapesAccess::TargetShape*>& targetShapes,
+    const FbxMatrix& transform,
+    const FbxMatrix& inverseTransposeTransform,
+    const int polygonIndex,
+    const int polygonVertexIndex,
+    const int controlPointIndex,
+    const FbxVector4& fbxPosition,
+    const Vec3f& normal,
+    const Vec4f& tangent,
+    BlendCornerDeltas& deltas) {
+  deltas.clear();
+  for (size_t shapeIx = 0; shapeIx < targetShapes.size(); shapeIx++) {
+    const FbxBlendShapesAccess::TargetShape* targetShape = targetShapes[shapeIx];
+    RawBlendVertex blendVertex;
+    // the morph target data must be transformed just as with the vertex positions
+    const FbxVector4& shapePosition =
+        transform.MultNormalize(targetShape->positions[controlPointIndex]);
+    blendVertex.position = toVec3f(shapePosition - fbxPosition) * scaleFactor;
+    if (targetShape->normals.LayerPresent()) {
+      const FbxVector4& shapeNormal = targetShape->normals.GetElement(
+          polygonIndex,
+          polygonVertexIndex,
+          controlPointIndex,
+          FbxVector4(0.0f, 0.0f, 0.0f, 0.0f),
+          inverseTransposeTransform,
+          true);
+      blendVertex.normal = toVec3f(shapeNormal) - normal;
+    }
+    if (targetShape->tangents.LayerPresent()) {
+      const FbxVector4& shapeTangent = targetShape->tangents.GetElement(
+          polygonIndex,
+          polygonVertexIndex,
+          controlPointIndex,
+          FbxVector4(0.0f, 0.0f, 0.0f, 0.0f),
+          inverseTransposeTransform,
+          true);
+      blendVertex.tangent = toVec4f(shapeTangent) - tangent;
+    }
+    if (!(blendVertex == RawBlendVertex())) {
+      deltas.emplace_back((int)shapeIx, blendVertex);
+    }
+  }
+}
+
+// Everything about a polygon's material that only depends on its mesh material slot.
+struct ResolvedMaterialSlot {
+  bool resolved = false;
+  FbxString name;
+  long id;
+  std::shared_ptr<RawMatProps> props;
+  int textures[RAW_TEXTURE_USAGE_MAX];
+  std::vector<std::string> userProperties;
+  // the RawModel material, once added, without and with vertex transparency
+  int rawMaterialIndex[2] = {-1, -1};
+};
+
+static void ResolveMaterialSlot(
+    RawModel& raw,
+    const std::shared_ptr<FbxMaterialInfo>& fbxMaterial,
+    const std::map<const FbxTexture*, FbxString>& textureLocations,
+    ResolvedMaterialSlot& slot) {
+  slot.resolved = true;
+  std::fill_n(slot.textures, (int)RAW_TEXTURE_USAGE_MAX, -1);
+
+  if (fbxMaterial == nullptr) {
+    slot.name = "DefaultMaterial";
+    slot.id = -1;
+    // Default to defaults from
+    // https://github.com/KhronosGroup/glTF/tree/master/specification/2.0#reference-material
+    slot.props.reset(new RawMetRoughMatProps(
+        RAW_SHADING_MODEL_PBR_MET_ROUGH,
+        Vec4f(1, 1, 1, 1),
+        Vec3f(0, 0, 0),
+        0.0f,
+        1.0f,
+        1.0f,
+        false));
+
+  } else {
+    slot.name = fbxMaterial->name;
+    slot.id = fbxMaterial->id;
+
+    const auto maybeAddTexture = [&](const FbxFileTexture* tex, RawTextureUsage usage) {
+      if (tex != nullptr) {
+        // dig out the inferred filename from the textureLocations map
+        FbxString inferredPath = textureLocations.find(tex)->second;
+
+        Vec2f translation(tex->GetTranslationU(), tex->GetTranslationV());
+        float rotation = tex->GetRotationW(); // FIXME is this right?
+        Vec2f scale(tex->GetScaleU(), tex->GetScaleV());
+
+        slot.textures[usage] = raw.AddTexture(
+            tex->GetName(),
+            tex->GetFileName(),
+            inferredPath.Buffer(),
+            usage,
+            translation,
+            rotation,
+            scale);
+      }
+    };
+
+    std::shared_ptr<RawMatProps> matInfo;
+    if (fbxMaterial->shadingModel == FbxRoughMetMaterialInfo::FBX_SHADER_METROUGH) {
+      FbxRoughMetMaterialInfo* fbxMatInfo =
+          static_cast<FbxRoughMetMaterialInfo*>(fbxMaterial.get());
+
+      maybeAddTexture(fbxMatInfo->texBaseColor, RAW_TEXTURE_USAGE_ALBEDO);
+      maybeAddTexture(fbxMatInfo->texNormal, RAW_TEXTURE_USAGE_NORMAL);
+      maybeAddTexture(fbxMatInfo->texEmissive, RAW_TEXTURE_USAGE_EMISSIVE);
+      maybeAddTexture(fbxMatInfo->texRoughness, RAW_TEXTURE_USAGE_ROUGHNESS);
+      maybeAddTexture(fbxMatInfo->texMetallic, RAW_TEXTURE_USAGE_METALLIC);
+      maybeAddTexture(fbxMatInfo->texAmbientOcclusion, RAW_TEXTURE_USAGE_OCCLUSION);
+
+      maybeAddOwtTexture(
+          raw,
+          fbxMatInfo->texBaseColor,
+          slot.textures,
+          textureLocations,
+          RAW_TEXTURE_USAGE_AO_MET_ROUGH,
+          "all",
+          "",
+          "ref");
+      maybeAddOwtTexture(
+          raw,
+          fbxMatInfo->texBaseColor,
+          slot.textures,
+          textureLocations,
+          RAW_TEXTURE_USAGE_MODULATION,
+          "all",
+          "damage",
+          "mask");
+
+      maybeAddOwtTexture(
+          raw,
+          fbxMatInfo->texBaseColor,
+          slot.textures,
+          textureLocations,
+          RAW_TEXTURE_USAGE_NORMAL,
+          "all",
+          "",
+          "norm");
+
+      slot.props.reset(new RawMetRoughMatProps(
+          RAW_SHADING_MODEL_PBR_MET_ROUGH,
+          toVec4f(fbxMatInfo->baseColor),
+          toVec3f(fbxMatInfo->emissive),
+          fbxMatInfo->emissiveIntensity,
+          fbxMatInfo->metallic,
+          fbxMatInfo->roughness,
+          fbxMatInfo->invertRoughnessMap));
+    } else {
+      FbxTraditionalMaterialInfo* fbxMatInfo =
+          static_cast<FbxTraditionalMaterialInfo*>(fbxMaterial.get());
+      RawShadingModel shadingModel;
+      if (fbxMaterial->shadingModel == "Lambert") {
+        shadingModel = RAW_SHADING_MODEL_LAMBERT;
+      } else if (0 == fbxMaterial->shadingModel.CompareNoCase("Blinn")) {
+        shadingModel = RAW_SHADING_MODEL_BLINN;
+      } else if (0 == fbxMaterial->shadingModel.CompareNoCase("Phong")) {
+        shadingModel = RAW_SHADING_MODEL_PHONG;
+      } else if (0 == fbxMaterial->shadingModel.CompareNoCase("Constant")) {
+        shadingModel = RAW_SHADING_MODEL_PHONG;
+      } else {
+        shadingModel = RAW_SHADING_MODEL_UNKNOWN;
+      }
+      maybeAddTexture(fbxMatInfo->texDiffuse, RAW_TEXTURE_USAGE_DIFFUSE);
+      maybeAddTexture(fbxMatInfo->texNormal, RAW_TEXTURE_USAGE_NORMAL);
+      maybeAddTexture(fbxMatInfo->texEmissive, RAW_TEXTURE_USAGE_EMISSIVE);
+      maybeAddTexture(fbxMatInfo->texShininess, RAW_TEXTURE_USAGE_SHININESS);
+      maybeAddTexture(fbxMatInfo->texAmbient, RAW_TEXTURE_USAGE_AMBIENT);
+      maybeAddTexture(fbxMatInfo->texSpecular, RAW_TEXTURE_USAGE_SPECULAR);
+      maybeAddOwtTexture(
+          raw,
+          fbxMatInfo->texDiffuse,
+          slot.textures,
+          textureLocations,
+          RAW_TEXTURE_USAGE_AO_MET_ROUGH,
+          "all",
+          "",
+          "ref");
+      maybeAddOwtTexture(
+          raw,
+          fbxMatInfo->texDiffuse,
+          slot.textures,
+          textureLocations,
+          RAW_TEXTURE_USAGE_MODULATION,
+          "all",
+          "damage",
+          "mask");
+
+      maybeAddOwtTexture(
+          raw,
+          fbxMatInfo->texDiffuse,
+          slot.textures,
+          textureLocations,
+          RAW_TEXTURE_USAGE_NORMAL,
+          "all",
+          "",
+          "norm");
+
+      if (slot.textures[RAW_TEXTURE_USAGE_AO_MET_ROUGH] >= 0) {
+        slot.props.reset(new RawMetRoughMatProps(
+            RAW_SHADING_MODEL_PBR_MET_ROUGH,
+            toVec4f(fbxMatInfo->colDiffuse),
+            toVec3f(fbxMatInfo->colEmissive),
+            0,
+            1,
+            1,
+            false));
+      } else {
+        slot.props.reset(new RawTraditionalMatProps(
+            shadingModel,
+            toVec3f(fbxMatInfo->colAmbient),
+            toVec4f(fbxMatInfo->colDiffuse),
+            toVec3f(fbxMatInfo->colEmissive),
+            toVec3f(fbxMatInfo->colSpecular),
+            fbxMatInfo->shininess));
+      }
+    }
+  }
+}
+
 static void ReadMesh(
     RawModel& raw,
     FbxScene* pScene,
     FbxNode* pNode,
-    const std::map<const FbxTexture*, FbxString>& textureLocations) {
-  FbxGeometryConverter meshConverter(pScene->GetFbxManager());
-  meshConverter.Triangulate(pNode->GetNodeAttribute(), true);
+    const std::map<const FbxTexture*, FbxString>& textureLocations,
+    const GltfOptions& options) {
   FbxMesh* pMesh = pNode->GetMesh();
+  if (pMesh == nullptr ||
+      pNode->GetNodeAttribute()->GetAttributeType() != FbxNodeAttribute::eMesh) {
+    // NURBS, NURBS surfaces and patches only become meshes through FbxGeometryConverter, which
+    // triangulates them as it goes.
+    FbxGeometryConverter meshConverter(pScene->GetFbxManager());
+    meshConverter.Triangulate(pNode->GetNodeAttribute(), true);
+    pMesh = pNode->GetMesh();
+    if (pMesh == nullptr) {
+      return;
+    }
+  }
+  int nodeId = raw.GetNodeById(pNode->GetUniqueID());
+
+  if (raw.GetSurfaceById(pMesh->GetUniqueID()) >= 0) {
+    // This surface is already loaded
+    if (nodeId >= 0) {
+      raw.GetNode(nodeId).surfaceId = pMesh->GetUniqueID();
+    }
+    return;
+  }
+
+  // The polygons of real meshes are split into triangles as their corners are read below. Only
+  // meshes with polygons we cannot triangulate ourselves go through FbxGeometryConverter, which
+  // replaces the mesh, and with it the surface id, in every node that uses it.
+  std::unique_ptr<FbxMeshTriangulation> triangulation(new FbxMeshTriangulation(pMesh));
+  const FbxMeshTriangulation::Stats triangulationStats = triangulation->GetStats();
+  if (triangulation->NeedsFallback()) {
+    FbxGeometryConverter meshConverter(pScene->GetFbxManager());
+    meshConverter.Triangulate(pNode->GetNodeAttribute(), true);
+    pMesh = pNode->GetMesh();
+    triangulation.reset(new FbxMeshTriangulation(pMesh));
+  }
 
   // Obtains the surface Id
   const long surfaceId = pMesh->GetUniqueID();
 
   // Associate the node to this surface
-  int nodeId = raw.GetNodeById(pNode->GetUniqueID());
   if (nodeId >= 0) {
     RawNode& node = raw.GetNode(nodeId);
     node.surfaceId = surfaceId;
@@ -248,7 +625,7 @@ static void ReadMesh(
   const FbxLayerElementAccess<FbxVector2> uvLayer1(
       pMesh->GetElementUV(1), pMesh->GetElementUVCount());
   const FbxSkinningAccess skinning(pMesh, pScene, pNode);
-  const FbxMaterialsAccess materials(pMesh, textureLocations);
+  const FbxMaterialsAccess materials(pMesh, textureLocations, options.enableUserProperties);
   const FbxBlendShapesAccess blendShapes(pMesh);
 
   if (verboseOutput) {
@@ -258,6 +635,17 @@ static void ReadMesh(
         meshName,
         skinning.IsSkinned() ? raw.GetNode(raw.GetNodeById(skinning.GetRootNode())).name.c_str()
                              : "NO");
+    fmt::printf(
+        "    polygons: %d triangles, %d convex quads, %d concave quads, %d clipped, %d failed, "
+        "%d skipped -> %s\n",
+        triangulationStats.triangles,
+        triangulationStats.convexQuads,
+        triangulationStats.concaveQuads,
+        triangulationStats.clippedPolygons,
+        triangulationStats.failedPolygons,
+        triangulationStats.skippedPolygons,
+        (triangulationStats.failedPolygons > 0) ? "triangulated by the FBX SDK"
+                                                : "triangulated natively");
   }
 
   // The FbxNode geometric transformation describes how a FbxNodeAttribute is offset from
@@ -277,6 +665,30 @@ static void ReadMesh(
   const FbxMatrix normalTransform(FbxVector4(), meshRotation, meshScaling);
   const FbxMatrix inverseTransposeTransform = normalTransform.Inverse().Transpose();
 
+  // Resolve every layer once, at its own mapping granularity, so that the corner loop below only
+  // gathers; the transforms no longer run again for each corner sharing a control point.
+  std::vector<FbxVector4> meshPositions((size_t)std::max(0, pMesh->GetControlPointsCount()));
+  for (size_t pointIndex = 0; pointIndex < meshPositions.size(); pointIndex++) {
+    meshPositions[pointIndex] = transform.MultNormalize(controlPoints[pointIndex]);
+  }
+  const auto transformNormal = [&](const FbxVector4& element) {
+    FbxVector4 normal = inverseTransposeTransform.MultNormalize(element);
+    normal.Normalize();
+    return normal;
+  };
+  const std::vector<Vec3f> meshNormals = ResolveLayer<Vec3f>(
+      normalLayer, [&](const FbxVector4& element) { return toVec3f(transformNormal(element)); });
+  const std::vector<Vec4f> meshTangents = ResolveLayer<Vec4f>(
+      tangentLayer, [&](const FbxVector4& element) { return toVec4f(transformNormal(element)); });
+  const std::vector<Vec3f> meshBinormals = ResolveLayer<Vec3f>(
+      binormalLayer, [&](const FbxVector4& element) { return toVec3f(transformNormal(element)); });
+  const std::vector<Vec4f> meshColors = ResolveLayer<Vec4f>(colorLayer, [](const FbxColor& color) {
+    return Vec4f((float)color.mRed, (float)color.mGreen, (float)color.mBlue, (float)color.mAlpha);
+  });
+  const auto toUV = [](const FbxVector2& uv) { return Vec2f((float)uv[0], (float)uv[1]); };
+  const std::vector<Vec2f> meshUV0 = ResolveLayer<Vec2f>(uvLayer0, toUV);
+  const std::vector<Vec2f> meshUV1 = ResolveLayer<Vec2f>(uvLayer1, toUV);
+
   raw.AddVertexAttribute(RAW_VERTEX_ATTRIBUTE_POSITION);
   if (normalLayer.LayerPresent()) {
     raw.AddVertexAttribute(RAW_VERTEX_ATTRIBUTE_NORMAL);
@@ -314,14 +726,28 @@ static void ReadMesh(
     rawSurface.jointGeometryMins.emplace_back(FLT_MAX, FLT_MAX, FLT_MAX);
     rawSurface.jointGeometryMaxs.emplace_back(-FLT_MAX, -FLT_MAX, -FLT_MAX);
   }
+  const std::vector<RawVertexSkinningArray> meshSkinning = skinning.IsSkinned()
+      ? ResolveSkinning(
+            rawSurface,
+            skinning,
+            pMesh,
+            meshPositions,
+            (size_t)std::max(0, options.maxSkinningWeights))
+      : std::vector<RawVertexSkinningArray>();
 
   rawSurface.blendChannels.clear();
   std::vector<const FbxBlendShapesAccess::TargetShape*> targetShapes;
+  // Morph normals and tangents not mapped by control point can differ between corners that are
+  // otherwise the same vertex; such corners must become distinct vertices.
+  bool perCornerBlendDeltas = false;
   for (size_t channelIx = 0; channelIx < blendShapes.GetChannelCount(); channelIx++) {
     for (size_t targetIx = 0; targetIx < blendShapes.GetTargetShapeCount(channelIx); targetIx++) {
       const FbxBlendShapesAccess::TargetShape& shape =
           blendShapes.GetTargetShape(channelIx, targetIx);
       targetShapes.push_back(&shape);
+      perCornerBlendDeltas |= shape.normals.LayerPresent() && !shape.normals.MappedByControlPoint();
+      perCornerBlendDeltas |=
+          shape.tangents.LayerPresent() && !shape.tangents.MappedByControlPoint();
       auto& blendChannel = blendShapes.GetBlendChannel(channelIx);
 
       rawSurface.blendChannels.push_back(
@@ -332,297 +758,113 @@ static void ReadMesh(
     }
   }
 
-  int polygonVertexIndex = 0;
-  for (int polygonIndex = 0; polygonIndex < pMesh->GetPolygonCount(); polygonIndex++) {
-    FBX_ASSERT(pMesh->GetPolygonSize(polygonIndex) == 3);
-    const std::shared_ptr<FbxMaterialInfo> fbxMaterial = materials.GetMaterial(polygonIndex);
-    const std::vector<std::string> userProperties = materials.GetUserProperties(polygonIndex);
+  // per control point, the distinct corner deltas seen there so far (if perCornerBlendDeltas)
+  std::vector<std::vector<BlendCornerDeltas>> controlPointDeltaSets(
+      perCornerBlendDeltas ? meshPositions.size() : 0);
 
-    int textures[RAW_TEXTURE_USAGE_MAX];
-    std::fill_n(textures, (int)RAW_TEXTURE_USAGE_MAX, -1);
+  BlendCornerDeltas cornerDeltas[3];
 
-    std::shared_ptr<RawMatProps> rawMatProps;
-    FbxString materialName;
-    long materialId;
-
-    if (fbxMaterial == nullptr) {
-      materialName = "DefaultMaterial";
-      materialId = -1;
-      // Default to defaults from
-      // https://github.com/KhronosGroup/glTF/tree/master/specification/2.0#reference-material
-      rawMatProps.reset(new RawMetRoughMatProps(
-          RAW_SHADING_MODEL_PBR_MET_ROUGH,
-          Vec4f(1, 1, 1, 1),
-          Vec3f(0, 0, 0),
-          0.0f,
-          1.0f,
-          1.0f,
-          false));
+  // resolved on first use; slot 0 stands for polygons without a material
+  std::vector<ResolvedMaterialSlot> materialSlots(materials.GetMaterialSlotCount() + 1);
 
-    } else {
-      materialName = fbxMaterial->name;
-      materialId = fbxMaterial->id;
-
-      const auto maybeAddTexture = [&](const FbxFileTexture* tex, RawTextureUsage usage) {
-        if (tex != nullptr) {
-          // dig out the inferred filename from the textureLocations map
-          FbxString inferredPath = textureLocations.find(tex)->second;
-
-          Vec2f translation(tex->GetTranslationU(), tex->GetTranslationV());
-          float rotation = tex->GetRotationW(); // FIXME is this right?
-          Vec2f scale(tex->GetScaleU(), tex->GetScaleV());
-
-          textures[usage] = raw.AddTexture(
-              tex->GetName(),
-              tex->GetFileName(),
-              inferredPath.Buffer(),
-              usage,
-              translation,
-              rotation,
-              scale);
-        }
-      };
-
-      std::shared_ptr<RawMatProps> matInfo;
-      if (fbxMaterial->shadingModel == FbxRoughMetMaterialInfo::FBX_SHADER_METROUGH) {
-        FbxRoughMetMaterialInfo* fbxMatInfo =
-            static_cast<FbxRoughMetMaterialInfo*>(fbxMaterial.get());
-
-        maybeAddTexture(fbxMatInfo->texBaseColor, RAW_TEXTURE_USAGE_ALBEDO);
-        maybeAddTexture(fbxMatInfo->texNormal, RAW_TEXTURE_USAGE_NORMAL);
-        maybeAddTexture(fbxMatInfo->texEmissive, RAW_TEXTURE_USAGE_EMISSIVE);
-        maybeAddTexture(fbxMatInfo->texRoughness, RAW_TEXTURE_USAGE_ROUGHNESS);
-        maybeAddTexture(fbxMatInfo->texMetallic, RAW_TEXTURE_USAGE_METALLIC);
-        maybeAddTexture(fbxMatInfo->texAmbientOcclusion, RAW_TEXTURE_USAGE_OCCLUSION);
-
-        maybeAddOwtTexture(
-            raw,
-            fbxMatInfo->texBaseColor,
-            textures,
-            textureLocations,
-            RAW_TEXTURE_USAGE_AO_MET_ROUGH,
-            "all",
-            "",
-            "ref");
-        maybeAddOwtTexture(
-            raw,
-            fbxMatInfo->texBaseColor,
-            textures,
-            textureLocations,
-            RAW_TEXTURE_USAGE_MODULATION,
-            "all",
-            "damage",
-            "mask");
-
-        maybeAddOwtTexture(
-            raw,
-            fbxMatInfo->texBaseColor,
-            textures,
-            textureLocations,
-            RAW_TEXTURE_USAGE_NORMAL,
-            "all",
-            "",
-            "norm");
-
-        rawMatProps.reset(new RawMetRoughMatProps(
-            RAW_SHADING_MODEL_PBR_MET_ROUGH,
-            toVec4f(fbxMatInfo->baseColor),
-            toVec3f(fbxMatInfo->emissive),
-            fbxMatInfo->emissiveIntensity,
-            fbxMatInfo->metallic,
-            fbxMatInfo->roughness,
-            fbxMatInfo->invertRoughnessMap));
-      } else {
-        FbxTraditionalMaterialInfo* fbxMatInfo =
-            static_cast<FbxTraditionalMaterialInfo*>(fbxMaterial.get());
-        RawShadingModel shadingModel;
-        if (fbxMaterial->shadingModel == "Lambert") {
-          shadingModel = RAW_SHADING_MODEL_LAMBERT;
-        } else if (0 == fbxMaterial->shadingModel.CompareNoCase("Blinn")) {
-          shadingModel = RAW_SHADING_MODEL_BLINN;
-        } else if (0 == fbxMaterial->shadingModel.CompareNoCase("Phong")) {
-          shadingModel = RAW_SHADING_MODEL_PHONG;
-        } else if (0 == fbxMaterial->shadingModel.CompareNoCase("Constant")) {
-          shadingModel = RAW_SHADING_MODEL_PHONG;
-        } else {
-          shadingModel = RAW_SHADING_MODEL_UNKNOWN;
-        }
-        maybeAddTexture(fbxMatInfo->texDiffuse, RAW_TEXTURE_USAGE_DIFFUSE);
-        maybeAddTexture(fbxMatInfo->texNormal, RAW_TEXTURE_USAGE_NORMAL);
-        maybeAddTexture(fbxMatInfo->texEmissive, RAW_TEXTURE_USAGE_EMISSIVE);
-        maybeAddTexture(fbxMatInfo->texShininess, RAW_TEXTURE_USAGE_SHININESS);
-        maybeAddTexture(fbxMatInfo->texAmbient, RAW_TEXTURE_USAGE_AMBIENT);
-        maybeAddTexture(fbxMatInfo->texSpecular, RAW_TEXTURE_USAGE_SPECULAR);
-        maybeAddOwtTexture(
-            raw,
-            fbxMatInfo->texDiffuse,
-            textures,
-            textureLocations,
-            RAW_TEXTURE_USAGE_AO_MET_ROUGH,
-            "all",
-            "",
-            "ref");
-        maybeAddOwtTexture(
-            raw,
-            fbxMatInfo->texDiffuse,
-            textures,
-            textureLocations,
-            RAW_TEXTURE_USAGE_MODULATION,
-            "all",
-            "damage",
-            "mask");
-
-        maybeAddOwtTexture(
-            raw,
-            fbxMatInfo->texDiffuse,
-            textures,
-            textureLocations,
-            RAW_TEXTURE_USAGE_NORMAL,
-            "all",
-            "",
-            "norm");
-
-        if (textures[RAW_TEXTURE_USAGE_AO_MET_ROUGH] >= 0) {
-          rawMatProps.reset(new RawMetRoughMatProps(
-              RAW_SHADING_MODEL_PBR_MET_ROUGH,
-              toVec4f(fbxMatInfo->colDiffuse),
-              toVec3f(fbxMatInfo->colEmissive),
-              0,
-              1,
-              1,
-              false));
-        } else {
-          rawMatProps.reset(new RawTraditionalMatProps(
-              shadingModel,
-              toVec3f(fbxMatInfo->colAmbient),
-              toVec4f(fbxMatInfo->colDiffuse),
-              toVec3f(fbxMatInfo->colEmissive),
-              toVec3f(fbxMatInfo->colSpecular),
-              fbxMatInfo->shininess));
-        }
-      }
+  const int* polygonVertices = pMesh->GetPolygonVertices();
+  for (int triangleIndex = 0; triangleIndex < triangulation->GetTriangleCount(); triangleIndex++) {
+    const int polygonIndex = triangulation->GetPolygonIndex(triangleIndex);
+    const int materialSlot = materials.GetMaterialSlot(polygonIndex);
+    ResolvedMaterialSlot& slot = materialSlots[materialSlot + 1];
+    if (!slot.resolved) {
+      slot.userProperties = materials.GetUserProperties(polygonIndex);
+      ResolveMaterialSlot(raw, materials.GetMaterial(polygonIndex), textureLocations, slot);
     }
 
     RawVertex rawVertices[3];
+    int cornerPolygonVertexIndices[3];
+    FbxVector4 cornerPositions[3];
+    Vec3f cornerNormals[3];
+    Vec4f cornerTangents[3];
     bool vertexTransparency = false;
-    for (int vertexIndex = 0; vertexIndex < 3; vertexIndex++, polygonVertexIndex++) {
-      const int controlPointIndex = pMesh->GetPolygonVertex(polygonIndex, vertexIndex);
+    for (int vertexIndex = 0; vertexIndex < 3; vertexIndex++) {
+      const int polygonVertexIndex =
+          triangulation->GetPolygonVertexIndex(triangleIndex, vertexIndex);
+      const int controlPointIndex = polygonVertices[polygonVertexIndex];
+
+      const FbxVector4& fbxPosition = meshPositions[controlPointIndex];
 
+      RawVertex& vertex = rawVertices[vertexIndex];
+      vertex.position = toVec3f(fbxPosition) * scaleFactor;
       // Note that the default values here must be the same as the RawVertex default values!
-      const FbxVector4 fbxPosition = transform.MultNormalize(controlPoints[controlPointIndex]);
-      const FbxVector4 fbxNormal = normalLayer.GetElement(
+      vertex.normal = GatherLayer(
+          normalLayer,
+          meshNormals,
           polygonIndex,
           polygonVertexIndex,
           controlPointIndex,
-          FbxVector4(0.0f, 0.0f, 0.0f, 0.0f),
-          inverseTransposeTransform,
-          true);
-      const FbxVector4 fbxTangent = tangentLayer.GetElement(
+          Vec3f(0.0f));
+      vertex.tangent = GatherLayer(
+          tangentLayer,
+          meshTangents,
           polygonIndex,
           polygonVertexIndex,
           controlPointIndex,
-          FbxVector4(0.0f, 0.0f, 0.0f, 0.0f),
-          inverseTransposeTransform,
-          true);
-      const FbxVector4 fbxBinormal = binormalLayer.GetElement(
+          Vec4f(0.0f));
+      vertex.binormal = GatherLayer(
+          binormalLayer,
+          meshBinormals,
           polygonIndex,
           polygonVertexIndex,
           controlPointIndex,
-          FbxVector4(0.0f, 0.0f, 0.0f, 0.0f),
-          inverseTransposeTransform,
-          true);
-      const FbxColor fbxColor = colorLayer.GetElement(
-          polygonIndex, polygonVertexIndex, controlPointIndex, FbxColor(0.0f, 0.0f, 0.0f, 0.0f));
-      const FbxVector2 fbxUV0 = uvLayer0.GetElement(
-          polygonIndex, polygonVertexIndex, controlPointIndex, FbxVector2(0.0f, 0.0f));
-      const FbxVector2 fbxUV1 = uvLayer1.GetElement(
-          polygonIndex, polygonVertexIndex, controlPointIndex, FbxVector2(0.0f, 0.0f));
-
-      RawVertex& vertex = rawVertices[vertexIndex];
-      vertex.position[0] = (float)fbxPosition[0] * scaleFactor;
-      vertex.position[1] = (float)fbxPosition[1] * scaleFactor;
-      vertex.position[2] = (float)fbxPosition[2] * scaleFactor;
-      vertex.normal[0] = (float)fbxNormal[0];
-      vertex.normal[1] = (float)fbxNormal[1];
-      vertex.normal[2] = (float)fbxNormal[2];
-      vertex.tangent[0] = (float)fbxTangent[0];
-      vertex.tangent[1] = (float)fbxTangent[1];
-      vertex.tangent[2] = (float)fbxTangent[2];
-      vertex.tangent[3] = (float)fbxTangent[3];
-      vertex.binormal[0] = (float)fbxBinormal[0];
-      vertex.binormal[1] = (float)fbxBinormal[1];
-      vertex.binormal[2] = (float)fbxBinormal[2];
-      vertex.color[0] = (float)fbxColor.mRed;
-      vertex.color[1] = (float)fbxColor.mGreen;
-      vertex.color[2] = (float)fbxColor.mBlue;
-      vertex.color[3] = (float)fbxColor.mAlpha;
-      vertex.uv0[0] = (float)fbxUV0[0];
-      vertex.uv0[1] = (float)fbxUV0[1];
-      vertex.uv1[0] = (float)fbxUV1[0];
-      vertex.uv1[1] = (float)fbxUV1[1];
+          Vec3f(0.0f));
+      vertex.color = GatherLayer(
+          colorLayer, meshColors, polygonIndex, polygonVertexIndex, controlPointIndex, Vec4f(0.0f));
+      vertex.uv0 = GatherLayer(
+          uvLayer0, meshUV0, polygonIndex, polygonVertexIndex, controlPointIndex, Vec2f(0.0f));
+      vertex.uv1 = GatherLayer(
+          uvLayer1, meshUV1, polygonIndex, polygonVertexIndex, controlPointIndex, Vec2f(0.0f));
       if (skinning.IsSkinned()) {
-        const std::vector<FbxVertexSkinningInfo> skinningInfo =
-            skinning.GetVertexSkinningInfo(controlPointIndex);
-        for (int skinningIndex = 0; skinningIndex < skinningInfo.size(); skinningIndex++) {
-          const FbxVertexSkinningInfo& sourceSkinningInfo = skinningInfo[skinningIndex];
-          vertex.skinningInfo.push_back(
-              RawVertexSkinningInfo{sourceSkinningInfo.jointId, sourceSkinningInfo.weight});
-        }
+        vertex.skinningInfo = meshSkinning[controlPointIndex];
       }
       vertex.polarityUv0 = false;
 
       // flag this triangle as transparent if any of its corner vertices substantially deviates from
       // fully opaque
-      vertexTransparency |= colorLayer.LayerPresent() && (fabs(fbxColor.mAlpha - 1.0) > 1e-3);
+      vertexTransparency |= colorLayer.LayerPresent() && (fabs(vertex.color.w - 1.0) > 1e-3);
 
       rawSurface.bounds.AddPoint(vertex.position);
 
       if (!targetShapes.empty()) {
+        // unless they vary per corner, the deltas are only computed once this turns out to be a
+        // new vertex
         vertex.blendSurfaceIx = rawSurfaceIndex;
-        for (const auto* targetShape : targetShapes) {
-          RawBlendVertex blendVertex;
-          // the morph target data must be transformed just as with the vertex positions above
-          const FbxVector4& shapePosition =
-              transform.MultNormalize(targetShape->positions[controlPointIndex]);
-          blendVertex.position = toVec3f(shapePosition - fbxPosition) * scaleFactor;
-          if (targetShape->normals.LayerPresent()) {
-            const FbxVector4& normal = targetShape->normals.GetElement(
-                polygonIndex,
-                polygonVertexIndex,
-                controlPointIndex,
-                FbxVector4(0.0f, 0.0f, 0.0f, 0.0f),
-                inverseTransposeTransform,
-                true);
-            blendVertex.normal = toVec3f(normal - fbxNormal);
-          }
-          if (targetShape->tangents.LayerPresent()) {
-            const FbxVector4& tangent = targetShape->tangents.GetElement(
-                polygonIndex,
-                polygonVertexIndex,
-                controlPointIndex,
-                FbxVector4(0.0f, 0.0f, 0.0f, 0.0f),
-                inverseTransposeTransform,
-                true);
-            blendVertex.tangent = toVec4f(tangent - fbxTangent);
+        vertex.blendControlPointIx = controlPointIndex;
+        cornerPolygonVertexIndices[vertexIndex] = polygonVertexIndex;
+        cornerPositions[vertexIndex] = fbxPosition;
+        cornerNormals[vertexIndex] = vertex.normal;
+        cornerTangents[vertexIndex] = vertex.tangent;
+        if (perCornerBlendDeltas) {
+          ComputeBlendDeltas(
+              targetShapes,
+              transform,
+              inverseTransposeTransform,
+              polygonIndex,
+              polygonVertexIndex,
+              controlPointIndex,
+              fbxPosition,
+              vertex.normal,
+              vertex.tangent,
+              cornerDeltas[vertexIndex]);
+          std::vector<BlendCornerDeltas>& deltaSets = controlPointDeltaSets[controlPointIndex];
+          const auto it = std::find(deltaSets.begin(), deltaSets.end(), cornerDeltas[vertexIndex]);
+          vertex.blendDeltaSetIx = (int)(it - deltaSets.begin());
+          if (it == deltaSets.end()) {
+            deltaSets.push_back(cornerDeltas[vertexIndex]);
           }
-          vertex.blends.push_back(blendVertex);
         }
       } else {
         vertex.blendSurfaceIx = -1;
       }
-
-      if (skinning.IsSkinned()) {
-        FbxMatrix skinningMatrix = FbxMatrix() * 0.0;
-        for (int j = 0; j < vertex.skinningInfo.size(); j++)
-          skinningMatrix += skinning.GetJointSkinningTransform(vertex.skinningInfo[j].jointIndex) *
-              vertex.skinningInfo[j].jointWeight;
-
-        const FbxVector4 globalPosition = skinningMatrix.MultNormalize(fbxPosition);
-        calcMinMax(rawSurface, skinning, globalPosition, vertex.skinningInfo);
-      }
     }
 
-    if (textures[RAW_TEXTURE_USAGE_NORMAL] != -1) {
+    if (slot.textures[RAW_TEXTURE_USAGE_NORMAL] != -1) {
       // Distinguish vertices that are used by triangles with a different texture polarity to avoid
       // degenerate tangent space smoothing.
       const bool polarity =
@@ -634,13 +876,37 @@ static void ReadMesh(
 
     int rawVertexIndices[3];
     for (int vertexIndex = 0; vertexIndex < 3; vertexIndex++) {
+      const int vertexCount = raw.GetVertexCount();
       rawVertexIndices[vertexIndex] = raw.AddVertex(rawVertices[vertexIndex]);
+      if (targetShapes.empty() || rawVertexIndices[vertexIndex] != vertexCount) {
+        continue;
+      }
+      // a new blend shape vertex: record its delta in every channel that actually moves it
+      if (!perCornerBlendDeltas) {
+        ComputeBlendDeltas(
+            targetShapes,
+            transform,
+            inverseTransposeTransform,
+            polygonIndex,
+            cornerPolygonVertexIndices[vertexIndex],
+            rawVertices[vertexIndex].blendControlPointIx,
+            cornerPositions[vertexIndex],
+            cornerNormals[vertexIndex],
+            cornerTangents[vertexIndex],
+            cornerDeltas[vertexIndex]);
+      }
+      for (const auto& delta : cornerDeltas[vertexIndex]) {
+        rawSurface.blendChannels[delta.first].AddDelta(rawVertexIndices[vertexIndex], delta.second);
+      }
     }
 
-    const RawMaterialType materialType =
-        GetMaterialType(raw, *rawMatProps, textures, vertexTransparency, skinning.IsSkinned());
-    const int rawMaterialIndex = raw.AddMaterial(
-        materialId, materialName, materialType, textures, rawMatProps, userProperties);
+    int& rawMaterialIndex = slot.rawMaterialIndex[vertexTransparency ? 1 : 0];
+    if (rawMaterialIndex < 0) {
+      const RawMaterialType materialType = GetMaterialType(
+          raw, *slot.props, slot.textures, vertexTransparency, skinning.IsSkinned());
+      rawMaterialIndex = raw.AddMaterial(
+          slot.id, slot.name, materialType, slot.textures, slot.props, slot.userProperties);
+    }
 
     raw.AddTriangle(
         rawVertexIndices[0],
@@ -777,19 +1043,22 @@ static void ReadNodeAttributes(
     RawModel& raw,
     FbxScene* pScene,
     FbxNode* pNode,
-    const std::map<const FbxTexture*, FbxString>& textureLocations) {
+    const std::map<const FbxTexture*, FbxString>& textureLocations,
+    const GltfOptions& options) {
   if (!pNode->GetVisibility()) {
     return;
   }
 
   // Only support non-animated user defined properties for now
-  FbxProperty objectProperty = pNode->GetFirstProperty();
-  while (objectProperty.IsValid()) {
-    if (objectProperty.GetFlag(FbxPropertyFlags::eUserDefined)) {
-      ReadNodeProperty(raw, pNode, objectProperty);
-    }
+  if (options.enableUserProperties) {
+    FbxProperty objectProperty = pNode->GetFirstProperty();
+    while (objectProperty.IsValid()) {
+      if (objectProperty.GetFlag(FbxPropertyFlags::eUserDefined)) {
+        ReadNodeProperty(raw, pNode, objectProperty);
+      }
 
-    objectProperty = pNode->GetNextProperty(objectProperty);
+      objectProperty = pNode->GetNextProperty(objectProperty);
+    }
   }
 
   FbxNodeAttribute* pNodeAttribute = pNode->GetNodeAttribute();
@@ -801,7 +1070,7 @@ static void ReadNodeAttributes(
       case FbxNodeAttribute::eNurbsSurface:
       case FbxNodeAttribute::eTrimNurbsSurface:
       case FbxNodeAttribute::ePatch: {
-        ReadMesh(raw, pScene, pNode, textureLocations);
+        ReadMesh(raw, pScene, pNode, textureLocations, options);
         break;
       }
       /*
@@ -835,7 +1104,7 @@ static void ReadNodeAttributes(
   }
 
   for (int child = 0; child < pNode->GetChildCount(); child++) {
-    ReadNodeAttributes(raw, pScene, pNode->GetChild(child), textureLocations);
+    ReadNodeAttributes(raw, pScene, pNode->GetChild(child), textureLocations, options);
   }
 }
 
@@ -843,8 +1112,9 @@ static void ReadNodeAttributes(
  * Compute the local scale vector to use for a given node. This is an imperfect hack to cope with
  * the FBX node transform's eInheritRrs inheritance type, in which ancestral scale is ignored
  */
-static FbxVector4 computeLocalScale(FbxNode* pNode, FbxTime pTime = FBXSDK_TIME_INFINITE) {
-  const FbxVector4 lScale = pNode->EvaluateLocalTransform(pTime).GetS();
+// The scale to export for a node, given its already evaluated local transform.
+static FbxVector4 computeLocalScale(FbxNode* pNode, const FbxAMatrix& localTransform) {
+  const FbxVector4 lScale = localTransform.GetS();
   if (isnan(lScale[0]) || isnan(lScale[1]) || isnan(lScale[2])) {
     return FbxVector4(0, 0, 0, 1);
   }
@@ -904,7 +1174,7 @@ static void ReadNodeHierarchy(
   const FbxAMatrix localTransform = pNode->EvaluateLocalTransform();
   const FbxVector4 localTranslation = localTransform.GetT();
   const FbxQuaternion localRotation = localTransform.GetQ();
-  const FbxVector4 localScaling = computeLocalScale(pNode);
+  const FbxVector4 localScaling = computeLocalScale(pNode, localTransform);
 
   node.translation = toVec3f(localTranslation) * scaleFactor;
   node.rotation = toQuatf(localRotation);
@@ -938,10 +1208,60 @@ static void ReadNodeHierarchy(
 // recalculating every node up the hierarchy on every call, even if we've previously calculated that
 // transform. Trades memory for speed, but can literally take a conversion that takes 35 minutes and
 // make it take 8.
+//
+// Results are kept in one bucket per point in time. Callers drop what they are done with: frame by
+// frame with EvictBefore(), or node by node with EvictNode(). Should the cache still outgrow its
+// memory budget, the earliest bucket goes first. That suits a frame-major bake; a node-major bake
+// revisits every frame for each node, so over budget it mostly misses, and only the node evictions
+// keep it within bounds. Anything evicted is simply evaluated again if it's asked for.
 class CachingAnimEvaluator : public FbxAnimEvalClassic {
   FBXSDK_OBJECT_DECLARE(CachingAnimEvaluator, FbxAnimEvalClassic);
 
-  typedef std::tuple<FbxNode*, FbxTime, FbxNode::EPivotSet, bool> KeyType;
+ public:
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t peakEntries = 0;
+  };
+
+  // Roughly what one cached transform costs, bookkeeping included.
+  static const size_t ENTRY_SIZE_BYTES = sizeof(FbxNodeEvalState) + 64;
+
+  // A budget of 0 means no limit.
+  void SetMemoryBudget(const size_t budgetInBytes) {
+    maxEntries_ = budgetInBytes / ENTRY_SIZE_BYTES;
+  }
+
+  void EvictBefore(const FbxTime& pTime) {
+    while (!buckets_.empty() && buckets_.begin()->first < pTime.Get()) {
+      EvictEarliest();
+    }
+  }
+
+  // Drops the node's transforms at every point in time.
+  void EvictNode(FbxNode* pNode) {
+    for (auto bucketIt = buckets_.begin(); bucketIt != buckets_.end();) {
+      Bucket& bucket = bucketIt->second;
+      for (const auto pivotSet : {FbxNode::eSourcePivot, FbxNode::eDestinationPivot}) {
+        for (const bool applyTarget : {false, true}) {
+          const size_t erased = bucket.erase(KeyType(pNode, pivotSet, applyTarget));
+          entryCount_ -= erased;
+          stats_.evictions += erased;
+        }
+      }
+      bucketIt = bucket.empty() ? buckets_.erase(bucketIt) : std::next(bucketIt);
+    }
+  }
+
+  void Flush() {
+    buckets_.clear();
+    entryCount_ = 0;
+  }
+
+  const Stats& GetStats() const {
+    return stats_;
+  }
 
  protected:
   void EvaluateNodeTransform(
@@ -950,25 +1270,208 @@ class CachingAnimEvaluator : public FbxAnimEvalClassic {
       const FbxTime& pTime,
       FbxNode::EPivotSet pPivotSet,
       bool pApplyTarget) override {
-    auto cacheKey = std::make_tuple(pNode, pTime, pPivotSet, pApplyTarget);
-    auto it = cache_.find(cacheKey);
-    if (it != cache_.end()) {
-      *pResult = *it->second;
-      return;
+    const KeyType cacheKey(pNode, pPivotSet, pApplyTarget);
+    auto bucketIt = buckets_.find(pTime.Get());
+    if (bucketIt != buckets_.end()) {
+      auto it = bucketIt->second.find(cacheKey);
+      if (it != bucketIt->second.end()) {
+        stats_.hits++;
+        *pResult = *it->second;
+        return;
+      }
     }
+    stats_.misses++;
 
     FbxAnimEvalClassic::EvaluateNodeTransform(pResult, pNode, pTime, pPivotSet, pApplyTarget);
+    if (maxEntries_ > 0 && entryCount_ >= maxEntries_) {
+      EvictEarliest();
+      bucketIt = buckets_.find(pTime.Get());
+    }
+    if (bucketIt == buckets_.end()) {
+      bucketIt = buckets_.emplace(pTime.Get(), Bucket()).first;
+    }
     std::unique_ptr<FbxNodeEvalState> cacheState(new FbxNodeEvalState(pNode));
     *cacheState = *pResult;
-    cache_[cacheKey] = std::move(cacheState);
+    bucketIt->second[cacheKey] = std::move(cacheState);
+    entryCount_++;
+    stats_.peakEntries = std::max(stats_.peakEntries, entryCount_);
   }
 
  private:
-  std::map<KeyType, std::unique_ptr<FbxNodeEvalState>> cache_;
+  typedef std::tuple<FbxNode*, FbxNode::EPivotSet, bool> KeyType;
+  struct KeyHash {
+    size_t operator()(const KeyType& key) const {
+      size_t seed = std::hash<FbxNode*>()(std::get<0>(key));
+      seed ^= static_cast<size_t>(std::get<1>(key)) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+      seed ^= static_cast<size_t>(std::get<2>(key)) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+      return seed;
+    }
+  };
+  typedef std::unordered_map<KeyType, std::unique_ptr<FbxNodeEvalState>, KeyHash> Bucket;
+
+  void EvictEarliest() {
+    const auto earliest = buckets_.begin();
+    entryCount_ -= earliest->second.size();
+    stats_.evictions += earliest->second.size();
+    buckets_.erase(earliest);
+  }
+
+  std::map<FbxLongLong, Bucket> buckets_;
+  size_t entryCount_ = 0;
+  size_t maxEntries_ = 0;
+  Stats stats_;
 };
 
 FBXSDK_OBJECT_IMPLEMENT(CachingAnimEvaluator);
 
+static bool HasCurves(FbxPropertyDouble3& property, FbxAnimLayer* pLayer) {
+  return property.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_X) != nullptr ||
+      property.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_Y) != nullptr ||
+      property.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_Z) != nullptr;
+}
+
+static bool IsZero(const FbxDouble3& value) {
+  return value[0] == 0.0 && value[1] == 0.0 && value[2] == 0.0;
+}
+
+// Reads the curves of a vector property, in the given layer, as a glTF sampler that plays them back
+// exactly, if there is one: the X, Y and Z curves must have their keys at the same times, hold
+// their first and last values outside them, and either all hold their value from one key to the
+// next, or all interpolate linearly or along unweighted cubic tangents, which glTF's cubic splines
+// can express. Linear spans in a cubic track get the tangents that make them straight. Values and
+// tangents are scaled by valueScale, and times made relative to startTime.
+static bool ReadCurveTrack(
+    FbxPropertyDouble3& property,
+    FbxAnimLayer* pLayer,
+    const FbxTime& startTime,
+    const float valueScale,
+    std::vector<float>& times,
+    std::vector<Vec3f>& values,
+    RawInterpolation& interpolation) {
+  FbxAnimCurve* curves[3] = {property.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_X),
+                             property.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_Y),
+                             property.GetCurve(pLayer, FBXSDK_CURVENODE_COMPONENT_Z)};
+  const FbxAnimCurve* keyCurve = nullptr;
+  for (const FbxAnimCurve* curve : curves) {
+    if (curve != nullptr && keyCurve == nullptr) {
+      keyCurve = curve;
+    }
+  }
+  if (keyCurve == nullptr || keyCurve->KeyGetCount() == 0) {
+    return false;
+  }
+  const int keyCount = keyCurve->KeyGetCount();
+
+  bool hasStepSpans = false;
+  bool hasLinearSpans = false;
+  bool hasCubicSpans = false;
+  for (FbxAnimCurve* curve : curves) {
+    if (curve == nullptr) {
+      continue;
+    }
+    if (curve->KeyGetCount() != keyCount) {
+      return false;
+    }
+    // glTF holds the end values outside the keys; cycling or extending a curve needs baking
+    if (curve->GetPreExtrapolation() != FbxAnimCurveBase::eConstant ||
+        curve->GetPostExtrapolation() != FbxAnimCurveBase::eConstant) {
+      return false;
+    }
+    for (int keyIx = 0; keyIx < keyCount; keyIx++) {
+      if (curve->KeyGetTime(keyIx) != keyCurve->KeyGetTime(keyIx)) {
+        return false;
+      }
+      if (keyIx == keyCount - 1) {
+        break; // the last key's interpolation applies to no span
+      }
+      switch (curve->KeyGetInterpolation(keyIx)) {
+        case FbxAnimCurveDef::eInterpolationConstant:
+          if (curve->KeyGetConstantMode(keyIx) != FbxAnimCurveDef::eConstantStandard) {
+            return false;
+          }
+          hasStepSpans = true;
+          break;
+        case FbxAnimCurveDef::eInterpolationLinear:
+          hasLinearSpans = true;
+          break;
+        case FbxAnimCurveDef::eInterpolationCubic:
+          // these cover both this key's right tangent and the next key's left one
+          if (curve->KeyGetTangentWeightMode(keyIx) != FbxAnimCurveDef::eWeightedNone ||
+              curve->KeyGetTangentVelocityMode(keyIx) != FbxAnimCurveDef::eVelocityNone) {
+            return false;
+          }
+          hasCubicSpans = true;
+          break;
+        default:
+          return false;
+      }
+    }
+  }
+  if (hasStepSpans && (hasLinearSpans || hasCubicSpans)) {
+    return false;
+  }
+
+  std::vector<float> keyTimes;
+  for (int keyIx = 0; keyIx < keyCount; keyIx++) {
+    const float time = (float)(keyCurve->KeyGetTime(keyIx) - startTime).GetSecondDouble();
+    // glTF wants times to start at zero or later and to strictly increase
+    if (time < 0.0f || (!keyTimes.empty() && time <= keyTimes.back())) {
+      return false;
+    }
+    keyTimes.push_back(time);
+  }
+
+  const FbxDouble3 staticValue = property.Get();
+  std::vector<Vec3f> keyValues(keyCount);
+  for (int component = 0; component < 3; component++) {
+    for (int keyIx = 0; keyIx < keyCount; keyIx++) {
+      const double value = (curves[component] != nullptr) ? curves[component]->KeyGetValue(keyIx)
+                                                          : staticValue[component];
+      keyValues[keyIx][component] = (float)value * valueScale;
+    }
+  }
+
+  if (!hasCubicSpans) {
+    interpolation = hasStepSpans ? RAW_INTERPOLATION_STEP : RAW_INTERPOLATION_LINEAR;
+    times = std::move(keyTimes);
+    values = std::move(keyValues);
+    return true;
+  }
+
+  // the derivative of one component on the span that starts at keyIx, at either end of it
+  const auto getTangent = [&](const int component, const int keyIx, const bool atEnd) {
+    FbxAnimCurve* curve = curves[component];
+    if (curve == nullptr) {
+      return 0.0f;
+    }
+    if (curve->KeyGetInterpolation(keyIx) == FbxAnimCurveDef::eInterpolationCubic) {
+      return valueScale *
+          (atEnd ? curve->KeyGetLeftDerivative(keyIx + 1) : curve->KeyGetRightDerivative(keyIx));
+    }
+    return (keyValues[keyIx + 1][component] - keyValues[keyIx][component]) /
+        (keyTimes[keyIx + 1] - keyTimes[keyIx]);
+  };
+  std::vector<Vec3f> splineValues;
+  for (int keyIx = 0; keyIx < keyCount; keyIx++) {
+    Vec3f inTangent{0.0f}, outTangent{0.0f};
+    for (int component = 0; component < 3; component++) {
+      if (keyIx > 0) {
+        inTangent[component] = getTangent(component, keyIx - 1, true);
+      }
+      if (keyIx < keyCount - 1) {
+        outTangent[component] = getTangent(component, keyIx, false);
+      }
+    }
+    splineValues.push_back(inTangent);
+    splineValues.push_back(keyValues[keyIx]);
+    splineValues.push_back(outTangent);
+  }
+  interpolation = RAW_INTERPOLATION_CUBICSPLINE;
+  times = std::move(keyTimes);
+  values = std::move(splineValues);
+  return true;
+}
+
 static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& options) {
   FbxTime::EMode eMode = FbxTime::eFrames24;
   switch (options.animationFramerate) {
@@ -994,6 +1497,7 @@ static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& o
     // was a conflict in the merge
     //
     CachingAnimEvaluator* evaluator = CachingAnimEvaluator::Create(pScene, "CachingAnimEvaluator");
+    evaluator->SetMemoryBudget(static_cast<size_t>(options.animationCacheMegabytes) << 20);
     pScene->SetAnimationEvaluator(evaluator);
     /**
      * Individual animations are often concatenated on the timeline, and the
@@ -1010,10 +1514,28 @@ static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& o
      */
     FbxLongLong firstFrameIndex = -1;
     FbxLongLong lastFrameIndex = -1;
+    // Only the nodes with a curve on some property, in some layer, are baked below; everything else
+    // keeps its static transform.
+    std::unordered_set<const FbxNode*> animatedNodes;
     for (int layerIx = 0; layerIx < pAnimStack->GetMemberCount(); layerIx++) {
       FbxAnimLayer* layer = pAnimStack->GetMember<FbxAnimLayer>(layerIx);
       for (int nodeIx = 0; nodeIx < layer->GetMemberCount(); nodeIx++) {
         auto* node = layer->GetMember<FbxAnimCurveNode>(nodeIx);
+        bool hasCurves = false;
+        for (unsigned int channelIx = 0; channelIx < node->GetChannelsCount() && !hasCurves;
+             channelIx++) {
+          hasCurves = node->GetCurveCount(channelIx) > 0;
+        }
+        if (hasCurves) {
+          for (int propertyIx = 0; propertyIx < node->GetDstPropertyCount(); propertyIx++) {
+            const FbxNode* animatedNode =
+                FbxCast<FbxNode>(node->GetDstProperty(propertyIx).GetFbxObject());
+            if (animatedNode != nullptr) {
+              animatedNodes.insert(animatedNode);
+            }
+          }
+        }
+
         FbxTimeSpan nodeTimeSpan;
         // Multiple curves per curve node is not even supported by the SDK.
         for (int curveIx = 0; curveIx < node->GetCurveCount(0); curveIx++) {
@@ -1037,12 +1559,29 @@ static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& o
         }
       }
     }
+
+    // Nodes that compensate for their parent's scale depend on it.
+    std::vector<const FbxNode*> scaleCompensatingNodes;
+    for (const FbxNode* animatedNode : animatedNodes) {
+      for (int childIx = 0; childIx < animatedNode->GetChildCount(); childIx++) {
+        const FbxNode* childNode = animatedNode->GetChild(childIx);
+        FbxTransform::EInheritType inheritType;
+        childNode->GetTransformationInheritType(inheritType);
+        if (inheritType == FbxTransform::eInheritRrs) {
+          scaleCompensatingNodes.push_back(childNode);
+        }
+      }
+    }
+    animatedNodes.insert(scaleCompensatingNodes.begin(), scaleCompensatingNodes.end());
+
     RawAnimation animation;
     animation.name = animStackName;
 
     if (verboseOutput) {
       fmt::printf(
             "Animation %s: [%lu - %lu]\n", std::string(animStackName), firstFrameIndex, lastFrameIndex);
+      fmt::printf(
+          "    animated nodes: %zu of %d\n", animatedNodes.size(), pScene->GetNodeCount());
 
       fmt::printf("animation %zu: %s (%d%%)\n", animIx, (const char*)animStackName, 0);
     }
@@ -1054,15 +1593,52 @@ static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& o
       animation.times.emplace_back((float)pTime.GetSecondDouble());
     }
 
-    size_t totalSizeInBytes = 0;
+    // With a single layer, there's nothing to blend, so curves can be read as they are; see
+    // ReadCurveTrack().
+    FbxAnimLayer* curveLayer = nullptr;
+    if (options.animationCurves && pAnimStack->GetMemberCount<FbxAnimLayer>() == 1) {
+      curveLayer = pAnimStack->GetMember<FbxAnimLayer>(0);
+    }
+    FbxTime startTime;
+    startTime.SetFrame(firstFrameIndex, eMode);
+    size_t curveTrackCount = 0;
+    size_t bakedTrackCount = 0;
+
+    // Nodes to bake, in scene order, which is also the order their channels end up in.
+    struct BakedNode {
+      FbxNode* pNode;
+      std::unique_ptr<FbxBlendShapesAccess> blendShapes;
+      RawChannel channel;
+      bool bakeTranslation;
+      bool bakeRotation;
+      bool bakeScale;
+    };
+    std::vector<BakedNode> bakedNodes;
 
     const int nodeCount = pScene->GetNodeCount();
     for (int nodeIndex = 0; nodeIndex < nodeCount; nodeIndex++) {
       FbxNode* pNode = pScene->GetNode(nodeIndex);
+
+      // blend shape weights are animated on the mesh, rather than on the node
+      FbxNodeAttribute* nodeAttr = pNode->GetNodeAttribute();
+      std::unique_ptr<FbxBlendShapesAccess> blendShapes;
+      bool hasAnimatedBlendShapes = false;
+      if (nodeAttr != nullptr && nodeAttr->GetAttributeType() == FbxNodeAttribute::EType::eMesh) {
+        // it's inelegant to recreate this same access class multiple times, but it's also dirt
+        // cheap...
+        blendShapes.reset(new FbxBlendShapesAccess(static_cast<FbxMesh*>(nodeAttr)));
+        for (size_t channelIx = 0; channelIx < blendShapes->GetChannelCount(); channelIx++) {
+          hasAnimatedBlendShapes |= (blendShapes->GetAnimation(channelIx, animIx) != nullptr);
+        }
+      }
+      if (!hasAnimatedBlendShapes && animatedNodes.find(pNode) == animatedNodes.end()) {
+        continue;
+      }
+
       const FbxAMatrix baseTransform = pNode->EvaluateLocalTransform();
       FbxVector4 baseTranslation = baseTransform.GetT();
       FbxQuaternion baseRotation = baseTransform.GetQ();
-      const FbxVector4 baseScaling = computeLocalScale(pNode);
+      const FbxVector4 baseScaling = computeLocalScale(pNode, baseTransform);
 
       if (isnan(baseTranslation[0]) || isnan(baseTranslation[1]) || isnan(baseTranslation[2]) ||
           isnan(baseTranslation[3])) {
@@ -1090,39 +1666,150 @@ static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& o
         fmt::printf("baseScaling: %f, %f, %f\n", baseScaling[0], baseScaling[1], baseScaling[2]);
       }
 
-      RawChannel channel;
+      bakedNodes.push_back(
+          BakedNode{pNode, std::move(blendShapes), RawChannel(), true, true, true});
+      BakedNode& bakedNode = bakedNodes.back();
+      RawChannel& channel = bakedNode.channel;
       channel.nodeIndex = raw.GetNodeById(pNode->GetUniqueID());
 
+      if (curveLayer != nullptr) {
+        // Pivots and offsets mix rotation and scale into the local translation, and limits clamp
+        // it; without them, it's just LclTranslation. The local scale is always LclScaling, except
+        // for nodes that compensate for their parent's scale, see computeLocalScale().
+        FbxTransform::EInheritType inheritType;
+        pNode->GetTransformationInheritType(inheritType);
+        const bool plainTranslation = !pNode->TranslationActive.Get() &&
+            IsZero(pNode->RotationOffset.Get()) && IsZero(pNode->RotationPivot.Get()) &&
+            IsZero(pNode->ScalingOffset.Get()) && IsZero(pNode->ScalingPivot.Get());
+        const bool plainScale = !pNode->ScalingActive.Get() &&
+            (inheritType != FbxTransform::eInheritRrs || pNode->GetParent() == nullptr);
+
+        // tracks without curves just hold the rest pose, and need not be exported at all
+        if (plainTranslation) {
+          bakedNode.bakeTranslation = HasCurves(pNode->LclTranslation, curveLayer) &&
+              !ReadCurveTrack(
+                  pNode->LclTranslation,
+                  curveLayer,
+                  startTime,
+                  scaleFactor,
+                  channel.translationTimes,
+                  channel.translations,
+                  channel.translationInterpolation);
+        }
+        bakedNode.bakeRotation = HasCurves(pNode->LclRotation, curveLayer);
+        if (plainScale) {
+          bakedNode.bakeScale = HasCurves(pNode->LclScaling, curveLayer) &&
+              !ReadCurveTrack(
+                  pNode->LclScaling,
+                  curveLayer,
+                  startTime,
+                  1.0f,
+                  channel.scaleTimes,
+                  channel.scales,
+                  channel.scaleInterpolation);
+        }
+      }
+      curveTrackCount += !channel.translations.empty() + !channel.scales.empty();
+      bakedTrackCount += bakedNode.bakeTranslation + bakedNode.bakeRotation + bakedNode.bakeScale;
+    }
+
+    const auto bakeTransform = [&](BakedNode& bakedNode, const FbxTime& pTime) {
+      if (!bakedNode.bakeTranslation && !bakedNode.bakeRotation && !bakedNode.bakeScale) {
+        return;
+      }
+      const FbxAMatrix localTransform = bakedNode.pNode->EvaluateLocalTransform(pTime);
+      if (bakedNode.bakeTranslation) {
+        bakedNode.channel.translations.push_back(toVec3f(localTransform.GetT()) * scaleFactor);
+      }
+      if (bakedNode.bakeRotation) {
+        bakedNode.channel.rotations.push_back(toQuatf(localTransform.GetQ()));
+      }
+      if (bakedNode.bakeScale) {
+        bakedNode.channel.scales.push_back(
+            toVec3f(computeLocalScale(bakedNode.pNode, localTransform)));
+      }
+    };
+
+    if (options.animationFrameMajor) {
+      // Visit parents before their children, so that every node's ancestors are already in the
+      // evaluator's cache, which then only ever needs to hold the current frame.
+      std::vector<std::pair<int, size_t>> topDownOrder;
+      for (size_t bakedIx = 0; bakedIx < bakedNodes.size(); bakedIx++) {
+        int depth = 0;
+        for (FbxNode* pParent = bakedNodes[bakedIx].pNode->GetParent(); pParent != nullptr;
+             pParent = pParent->GetParent()) {
+          depth++;
+        }
+        topDownOrder.emplace_back(depth, bakedIx);
+      }
+      std::sort(topDownOrder.begin(), topDownOrder.end());
+
       for (FbxLongLong frameIndex = firstFrameIndex; frameIndex <= lastFrameIndex; frameIndex++) {
         FbxTime pTime;
         pTime.SetFrame(frameIndex, eMode);
 
-        const FbxAMatrix localTransform = pNode->EvaluateLocalTransform(pTime);
-        const FbxVector4 localTranslation = localTransform.GetT();
-        const FbxQuaternion localRotation = localTransform.GetQ();
-        const FbxVector4 localScale = computeLocalScale(pNode, pTime);
+        evaluator->EvictBefore(pTime);
+        for (const auto& entry : topDownOrder) {
+          bakeTransform(bakedNodes[entry.second], pTime);
+        }
+
+        if (verboseOutput) {
+          fmt::printf(
+              "\ranimation %d: %s (%d%%)",
+              animIx,
+              (const char*)animStackName,
+              (int)((frameIndex - firstFrameIndex) * 100 / (lastFrameIndex - firstFrameIndex + 1)));
+        }
+      }
+    } else {
+      // A node's cached transforms are only of use until the last node below it is baked; drop
+      // them then, so the cache holds no more than the ancestors of the nodes still to come.
+      std::unordered_map<FbxNode*, size_t> lastUse;
+      for (size_t bakedIx = 0; bakedIx < bakedNodes.size(); bakedIx++) {
+        for (FbxNode* pAncestor = bakedNodes[bakedIx].pNode; pAncestor != nullptr;
+             pAncestor = pAncestor->GetParent()) {
+          lastUse[pAncestor] = bakedIx;
+        }
+      }
+      std::vector<std::vector<FbxNode*>> evictAfter(bakedNodes.size());
+      for (const auto& use : lastUse) {
+        evictAfter[use.second].push_back(use.first);
+      }
+
+      for (size_t bakedIx = 0; bakedIx < bakedNodes.size(); bakedIx++) {
+        for (FbxLongLong frameIndex = firstFrameIndex; frameIndex <= lastFrameIndex; frameIndex++) {
+          FbxTime pTime;
+          pTime.SetFrame(frameIndex, eMode);
+          bakeTransform(bakedNodes[bakedIx], pTime);
+        }
+        for (FbxNode* pNode : evictAfter[bakedIx]) {
+          evaluator->EvictNode(pNode);
+        }
 
-        channel.translations.push_back(toVec3f(localTranslation) * scaleFactor);
-        channel.rotations.push_back(toQuatf(localRotation));
-        channel.scales.push_back(toVec3f(localScale));
+        if (verboseOutput) {
+          fmt::printf(
+              "\ranimation %d: %s (%d%%)",
+              animIx,
+              (const char*)animStackName,
+              (int)(bakedIx * 100 / bakedNodes.size()));
+        }
       }
+    }
 
-      std::vector<FbxAnimCurve*> shapeAnimCurves;
-      FbxNodeAttribute* nodeAttr = pNode->GetNodeAttribute();
-      if (nodeAttr != nullptr && nodeAttr->GetAttributeType() == FbxNodeAttribute::EType::eMesh) {
-        // it's inelegant to recreate this same access class multiple times, but it's also dirt
-        // cheap...
-        FbxBlendShapesAccess blendShapes(static_cast<FbxMesh*>(nodeAttr));
+    size_t totalSizeInBytes = 0;
 
+    for (BakedNode& bakedNode : bakedNodes) {
+      if (bakedNode.blendShapes != nullptr) {
+        const FbxBlendShapesAccess* blendShapes = bakedNode.blendShapes.get();
         for (FbxLongLong frameIndex = firstFrameIndex; frameIndex <= lastFrameIndex; frameIndex++) {
           FbxTime pTime;
           pTime.SetFrame(frameIndex, eMode);
 
-          for (size_t channelIx = 0; channelIx < blendShapes.GetChannelCount(); channelIx++) {
-            FbxAnimCurve* curve = blendShapes.GetAnimation(channelIx, animIx);
+          for (size_t channelIx = 0; channelIx < blendShapes->GetChannelCount(); channelIx++) {
+            FbxAnimCurve* curve = blendShapes->GetAnimation(channelIx, animIx);
             float influence = (curve != nullptr) ? curve->Evaluate(pTime) : 0; // 0-100
 
-            int targetCount = static_cast<int>(blendShapes.GetTargetShapeCount(channelIx));
+            int targetCount = static_cast<int>(blendShapes->GetTargetShapeCount(channelIx));
 
             // the target shape 'fullWeight' values are a strictly ascending list of floats (between
             // 0 and 100), forming a sequence of intervals -- this convenience function figures out
@@ -1134,13 +1821,13 @@ static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& o
               }
               double leftWeight = 0;
               if (n >= 0) {
-                leftWeight = blendShapes.GetTargetShape(channelIx, n).fullWeight;
+                leftWeight = blendShapes->GetTargetShape(channelIx, n).fullWeight;
                 if (p < leftWeight) {
                   return NAN;
                 }
                 // the first interval implicitly includes all lesser influence values
               }
-              double rightWeight = blendShapes.GetTargetShape(channelIx, n + 1).fullWeight;
+              double rightWeight = blendShapes->GetTargetShape(channelIx, n + 1).fullWeight;
               if (p > rightWeight && n + 1 < targetCount - 1) {
                 return NAN;
                 // the last interval implicitly includes all greater influence values
@@ -1154,14 +1841,14 @@ static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& o
                 float result = findInInterval(influence, targetIx - 1);
                 if (!std::isnan(result)) {
                   // we're transitioning into targetIx
-                  channel.weights.push_back(result);
+                  bakedNode.channel.weights.push_back(result);
                   continue;
                 }
                 if (targetIx != targetCount - 1) {
                   result = findInInterval(influence, targetIx);
                   if (!std::isnan(result)) {
                     // we're transitioning AWAY from targetIx
-                    channel.weights.push_back(1.0f - result);
+                    bakedNode.channel.weights.push_back(1.0f - result);
                     continue;
                   }
                 }
@@ -1169,28 +1856,25 @@ static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& o
 
               // this is here because we have to fill in a weight for every channelIx/targetIx
               // permutation, regardless of whether or not they participate in this animation.
-              channel.weights.push_back(0.0f);
+              bakedNode.channel.weights.push_back(0.0f);
             }
           }
         }
       }
 
-      animation.channels.emplace_back(channel);
-
+      const RawChannel& channel = bakedNode.channel;
       totalSizeInBytes += channel.translations.size() * sizeof(channel.translations[0]) +
           channel.rotations.size() * sizeof(channel.rotations[0]) +
           channel.scales.size() * sizeof(channel.scales[0]) +
           channel.weights.size() * sizeof(channel.weights[0]);
 
-      if (verboseOutput) {
-        fmt::printf(
-            "\ranimation %d: %s (%d%%)\n",
-            animIx,
-            (const char*)animStackName,
-            nodeIndex * 100 / nodeCount);
+      if (!channel.translations.empty() || !channel.rotations.empty() ||
+          !channel.scales.empty() || !channel.weights.empty()) {
+        animation.channels.emplace_back(std::move(bakedNode.channel));
       }
     }
 
+    const CachingAnimEvaluator::Stats cacheStats = evaluator->GetStats();
     evaluator->Destroy();
 
     raw.AddAnimation(animation);
@@ -1202,39 +1886,45 @@ static void ReadAnimations(RawModel& raw, FbxScene* pScene, const GltfOptions& o
           (const char*)animStackName,
           (int)animation.channels.size(),
           (float)totalSizeInBytes * 1e-6f);
+      fmt::printf(
+          "    transform cache: %zu hits, %zu misses, %zu evictions, peak %zu entries (%3.1f MB)\n",
+          cacheStats.hits,
+          cacheStats.misses,
+          cacheStats.evictions,
+          cacheStats.peakEntries,
+          (float)(cacheStats.peakEntries * CachingAnimEvaluator::ENTRY_SIZE_BYTES) * 1e-6f);
+      if (curveLayer != nullptr) {
+        fmt::printf(
+            "    tracks: %zu read from curves, %zu baked\n", curveTrackCount, bakedTrackCount);
+      }
     }
   }
 }
 
-static std::string FindFileLoosely(
-    const std::string& fbxFileName,
-    const std::string& directory,
-    const std::vector<std::string>& directoryFileList) {
-  if (FileUtils::FileExists(fbxFileName)) {
-    return fbxFileName;
-  }
-
-  // From e.g. C:/Assets/Texture.jpg, extract 'Texture.jpg'
-  const std::string fileName = FileUtils::GetFileName(fbxFileName);
+// Folder indices live for the whole run, so that converting several FBX files that share texture
+// folders only scans those once.
+static const FileUtils::FolderIndex& GetFolderIndex(
+    const std::string& folder,
+    const std::set<std::string>& extensions,
+    const bool recursive) {
+  static std::map<std::string, std::unique_ptr<FileUtils::FolderIndex>> folderIndices;
 
-  // Try to find a match with extension.
-  for (const auto& file : directoryFileList) {
-    if (StringUtils::CompareNoCase(fileName, FileUtils::GetFileName(file)) == 0) {
-      return directory + "/" + file;
-    }
+  std::string key = FileUtils::GetAbsolutePath(folder) + (recursive ? "|recursive" : "|flat");
+  for (const std::string& extension : extensions) {
+    key += "|" + extension;
   }
-
-  // Get the file name without file extension.
-  const std::string fileBase = FileUtils::GetFileBase(fileName);
-
-  // Try to find a match that ignores file extension
-  for (const auto& file : directoryFileList) {
-    if (StringUtils::CompareNoCase(fileBase, FileUtils::GetFileBase(file)) == 0) {
-      return directory + "/" + file;
+  std::unique_ptr<FileUtils::FolderIndex>& folderIndex = folderIndices[key];
+  if (folderIndex == nullptr) {
+    folderIndex.reset(new FileUtils::FolderIndex(folder, extensions, recursive));
+    if (verboseOutput) {
+      fmt::printf(
+          "Indexed %lu texture files in %s%s\n",
+          folderIndex->GetFileCount(),
+          folder,
+          recursive ? " and its subfolders" : "");
     }
   }
-
-  return "";
+  return *folderIndex;
 }
 
 /**
@@ -1245,19 +1935,11 @@ static std::string FindFileLoosely(
  **/
 static std::string FindFbxTexture(
     const std::string& textureFileName,
-    const std::vector<std::string>& folders,
-    const std::vector<std::vector<std::string>>& folderContents) {
+    const std::vector<const FileUtils::FolderIndex*>& folderIndices) {
   // it might exist exactly as-is on the running machine's filesystem
   if (FileUtils::FileExists(textureFileName)) {
     return textureFileName;
   }
-  // else look in other designated folders
-  for (int ii = 0; ii < folders.size(); ii++) {
-    const auto& fileLocation = FindFileLoosely(textureFileName, folders[ii], folderContents[ii]);
-    if (!fileLocation.empty()) {
-      return FileUtils::GetAbsolutePath(fileLocation);
-    }
-  }
   // Replace slashes with alternative platform version (e.g. '/' instead of '\\')
   std::string textureFileNameAltSlash = textureFileName;
   std::replace(
@@ -1265,15 +1947,27 @@ static std::string FindFbxTexture(
       textureFileNameAltSlash.end(),
       ALTERNATIVE_SLASH_CHAR,
       SLASH_CHAR);
-  // finally look with alternative slashes
-  for (int ii = 0; ii < folders.size(); ii++) {
-    const auto& fileLocation =
-        FindFileLoosely(textureFileNameAltSlash, folders[ii], folderContents[ii]);
-    if (!fileLocation.empty()) {
-      return FileUtils::GetAbsolutePath(fileLocation);
+  // else look in other designated folders, first as-is and then with alternative slashes
+  const auto findInFolders = [&folderIndices](const std::string& fileName) -> std::string {
+    // From e.g. C:/Assets/Texture.jpg, extract 'texture.jpg' and 'texture'
+    const std::string lowerFileName = StringUtils::ToLower(FileUtils::GetFileName(fileName));
+    const std::string lowerFileBase = StringUtils::ToLower(FileUtils::GetFileBase(fileName));
+    for (const FileUtils::FolderIndex* folderIndex : folderIndices) {
+      const std::string fileLocation = folderIndex->FindLoosely(lowerFileName, lowerFileBase);
+      if (!fileLocation.empty()) {
+        return fileLocation;
+      }
+    }
+    return "";
+  };
+  std::string fileLocation = findInFolders(textureFileName);
+  if (fileLocation.empty() && textureFileNameAltSlash != textureFileName) {
+    if (FileUtils::FileExists(textureFileNameAltSlash)) {
+      return FileUtils::GetAbsolutePath(textureFileNameAltSlash);
     }
+    fileLocation = findInFolders(textureFileNameAltSlash);
   }
-  return "";
+  return fileLocation.empty() ? "" : FileUtils::GetAbsolutePath(fileLocation);
 }
 
 /*
@@ -1283,32 +1977,33 @@ static std::string FindFbxTexture(
 
     This function takes a texture file name stored in the FBX, which may be an absolute
     path on the author's computer such as "C:\MyProject\TextureName.psd", and matches
-    it to a list of existing texture files in the same directory as the FBX file.
+    it to a list of existing texture files in the same directory as the FBX file, the
+    working directory, or any of the configured texture search roots.
 */
 static void FindFbxTextures(
     FbxScene* pScene,
     const std::string& fbxFileName,
     const std::set<std::string>& extensions,
+    const std::vector<TextureSearchRoot>& searchRoots,
     std::map<const FbxTexture*, FbxString>& textureLocations) {
   // figure out what folder the FBX file is in,
   const auto& fbxFolder = FileUtils::getFolder(fbxFileName);
-  std::vector<std::string> folders{
+  const std::vector<std::string> folders{
       // first search filename.fbm folder which the SDK itself expands embedded textures into,
       fbxFolder + "/" + FileUtils::GetFileBase(fbxFileName) + ".fbm", // filename.fbm
       // then the FBX folder itself,
       fbxFolder,
-      // then finally our working directory
+      // then our working directory
       FileUtils::GetCurrentFolder(),
   };
 
-  // List the contents of each of these folders (if they exist)
-  std::vector<std::vector<std::string>> folderContents;
+  // Index the contents of each of these folders (if they exist), and then of any extra ones
+  std::vector<const FileUtils::FolderIndex*> folderIndices;
   for (const auto& folder : folders) {
-    if (FileUtils::FolderExists(folder)) {
-      folderContents.push_back(FileUtils::ListFolderFiles(folder, extensions));
-    } else {
-      folderContents.push_back({});
-    }
+    folderIndices.push_back(&GetFolderIndex(folder, extensions, false));
+  }
+  for (const auto& searchRoot : searchRoots) {
+    folderIndices.push_back(&GetFolderIndex(searchRoot.folder, extensions, searchRoot.recursive));
   }
 
   // Try to match the FBX texture names with the actual files on disk.
@@ -1316,7 +2011,7 @@ static void FindFbxTextures(
     const FbxFileTexture* pFileTexture = FbxCast<FbxFileTexture>(pScene->GetTexture(i));
     if (pFileTexture != nullptr) {
       const std::string fileLocation =
-          FindFbxTexture(pFileTexture->GetFileName(), folders, folderContents);
+          FindFbxTexture(pFileTexture->GetFileName(), folderIndices);
       // always extend the mapping (even for files we didn't find)
       textureLocations.emplace(pFileTexture, fileLocation.c_str());
       if (fileLocation.empty()) {
@@ -1348,7 +2043,14 @@ bool LoadFBXFile(
     FbxXRefManager::sTemporaryFileProject = "temporaryFileProject";
   }
 
+  // Keep the SDK from even loading what we are not going to convert.
   FbxIOSettings* pIoSettings = FbxIOSettings::Create(pManager, IOSROOT);
+  const bool importTextures = options.importScope.materials && options.importScope.textures;
+  pIoSettings->SetBoolProp(IMP_FBX_ANIMATION, options.importScope.animations);
+  pIoSettings->SetBoolProp(IMP_FBX_MATERIAL, options.importScope.materials);
+  pIoSettings->SetBoolProp(IMP_FBX_TEXTURE, importTextures);
+  pIoSettings->SetBoolProp(IMP_FBX_LINK, options.importScope.skinning);
+  pIoSettings->SetBoolProp(IMP_FBX_SHAPE, options.importScope.blendShapes);
   pManager->SetIOSettings(pIoSettings);
   pManager->RegisterFbxClass(
       "CachingAnimEvaluator", FBX_TYPE(CachingAnimEvaluator), FBX_TYPE(FbxAnimEvalClassic));
@@ -1364,9 +2066,16 @@ bool LoadFBXFile(
     return false;
   }
 
+  const auto elapsedMs = [](const std::chrono::steady_clock::time_point& since) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since)
+        .count();
+  };
+  auto phaseStart = std::chrono::steady_clock::now();
+
   FbxScene* pScene = FbxScene::Create(pManager, "fbxScene");
   pImporter->Import(pScene);
   pImporter->Destroy();
+  const double importMs = elapsedMs(phaseStart);
 
   if (pScene == nullptr) {
     pImporter->Destroy();
@@ -1374,8 +2083,14 @@ bool LoadFBXFile(
     return false;
   }
 
+  // Textures missing from textureLocations are ignored by the material resolvers.
+  phaseStart = std::chrono::steady_clock::now();
   std::map<const FbxTexture*, FbxString> textureLocations;
-  FindFbxTextures(pScene, fbxFileName, textureExtensions, textureLocations);
+  if (importTextures) {
+    FindFbxTextures(
+        pScene, fbxFileName, textureExtensions, options.textureSearchRoots, textureLocations);
+  }
+  const double texturesMs = elapsedMs(phaseStart);
 
   // Use Y up for glTF
   FbxAxisSystem::MayaYUp.ConvertScene(pScene);
@@ -1392,9 +2107,26 @@ bool LoadFBXFile(
   // this is always 0.01, but let's opt for clarity.
   scaleFactor = FbxSystemUnit::m.GetConversionFactorFrom(FbxSystemUnit::cm);
 
+  phaseStart = std::chrono::steady_clock::now();
   ReadNodeHierarchy(raw, pScene, pScene->GetRootNode(), 0, "");
-  ReadNodeAttributes(raw, pScene, pScene->GetRootNode(), textureLocations);
-  ReadAnimations(raw, pScene, options);
+  ReadNodeAttributes(raw, pScene, pScene->GetRootNode(), textureLocations, options);
+  const double nodesMs = elapsedMs(phaseStart);
+
+  phaseStart = std::chrono::steady_clock::now();
+  if (options.importScope.animations) {
+    ReadAnimations(raw, pScene, options);
+  }
+  const double animationsMs = elapsedMs(phaseStart);
+
+  if (verboseOutput) {
+    fmt::printf(
+        "Import times: %.1f ms FBX SDK, %.1f ms textures, %.1f ms nodes and meshes, "
+        "%.1f ms animations\n",
+        importMs,
+        texturesMs,
+        nodesMs,
+        animationsMs);
+  }
 
   pScene->Destroy();
   pManager->Destroy();
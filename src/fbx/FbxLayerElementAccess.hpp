@@ -17,6 +17,29 @@ class FbxLayerElementAccess {
     return (mappingMode != FbxLayerElement::eNone);
   }
 
+  bool MappedByControlPoint() const {
+    return (mappingMode == FbxLayerElement::eByControlPoint);
+  }
+
+  // The number of elements the layer maps to: control points, polygon vertices or polygons.
+  int GetSourceCount() const {
+    return (indices != nullptr) ? indices->GetCount() : elements->GetCount();
+  }
+
+  // Which of those elements a polygon corner uses.
+  int GetSourceIndex(
+      const int polygonIndex,
+      const int polygonVertexIndex,
+      const int controlPointIndex) const {
+    return (mappingMode == FbxLayerElement::eByControlPoint)
+        ? controlPointIndex
+        : ((mappingMode == FbxLayerElement::eByPolygonVertex) ? polygonVertexIndex : polygonIndex);
+  }
+
+  _type_ GetSourceElement(const int sourceIndex) const {
+    return elements->GetAt((indices != nullptr) ? (*indices)[sourceIndex] : sourceIndex);
+  }
+
   _type_ GetElement(
       const int polygonIndex,
       const int polygonVertexIndex,
@@ -64,12 +87,7 @@ _type_ FbxLayerElementAccess<_type_>::GetElement(
     const int controlPointIndex,
     const _type_ defaultValue) const {
   if (mappingMode != FbxLayerElement::eNone) {
-    int index = (mappingMode == FbxLayerElement::eByControlPoint)
-        ? controlPointIndex
-        : ((mappingMode == FbxLayerElement::eByPolygonVertex) ? polygonVertexIndex : polygonIndex);
-    index = (indices != nullptr) ? (*indices)[index] : index;
-    _type_ element = elements->GetAt(index);
-    return element;
+    return GetSourceElement(GetSourceIndex(polygonIndex, polygonVertexIndex, controlPointIndex));
   }
   return defaultValue;
 }
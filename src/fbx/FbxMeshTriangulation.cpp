@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "FbxMeshTriangulation.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Newell's method; this also works for concave and slightly non-planar polygons. Its length is
+// twice the polygon's area, so it vanishes for degenerate polygons.
+static FbxVector4 GetPolygonNormal(
+    const FbxVector4* controlPoints,
+    const int* corners,
+    const int cornerCount) {
+  double normal[3] = {0.0, 0.0, 0.0};
+  for (int i = 0; i < cornerCount; i++) {
+    const FbxVector4& a = controlPoints[corners[i]];
+    const FbxVector4& b = controlPoints[corners[(i + 1) % cornerCount]];
+    normal[0] += (a[1] - b[1]) * (a[2] + b[2]);
+    normal[1] += (a[2] - b[2]) * (a[0] + b[0]);
+    normal[2] += (a[0] - b[0]) * (a[1] + b[1]);
+  }
+  return FbxVector4(normal[0], normal[1], normal[2], 0.0);
+}
+
+static bool IsConvexQuad(const FbxVector4* controlPoints, const int* corners) {
+  const FbxVector4 normal = GetPolygonNormal(controlPoints, corners, 4);
+  for (int i = 0; i < 4; i++) {
+    const FbxVector4& a = controlPoints[corners[(i + 3) % 4]];
+    const FbxVector4& b = controlPoints[corners[i]];
+    const FbxVector4& c = controlPoints[corners[(i + 1) % 4]];
+    const double e0[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    const double e1[3] = {c[0] - b[0], c[1] - b[1], c[2] - b[2]};
+    const double turn = (e0[1] * e1[2] - e0[2] * e1[1]) * normal[0] +
+        (e0[2] * e1[0] - e0[0] * e1[2]) * normal[1] + (e0[0] * e1[1] - e0[1] * e1[0]) * normal[2];
+    if (!(turn > 0.0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+FbxMeshTriangulation::FbxMeshTriangulation(const FbxMesh* pMesh) {
+  const FbxVector4* controlPoints = pMesh->GetControlPoints();
+  const int* polygonVertices = pMesh->GetPolygonVertices();
+  const int polygonCount = pMesh->GetPolygonCount();
+
+  trianglePolygons.reserve(polygonCount);
+  triangleCorners.reserve(polygonCount * 3);
+  for (int polygonIndex = 0; polygonIndex < polygonCount; polygonIndex++) {
+    const int polygonStart = pMesh->GetPolygonVertexIndex(polygonIndex);
+    const int polygonSize = pMesh->GetPolygonSize(polygonIndex);
+    if (polygonSize < 3) {
+      stats.skippedPolygons++;
+    } else if (polygonSize == 3) {
+      AddTriangle(polygonIndex, polygonStart, polygonStart + 1, polygonStart + 2);
+      stats.triangles++;
+    } else if (polygonSize == 4 && IsConvexQuad(controlPoints, &polygonVertices[polygonStart])) {
+      AddTriangle(polygonIndex, polygonStart, polygonStart + 1, polygonStart + 2);
+      AddTriangle(polygonIndex, polygonStart, polygonStart + 2, polygonStart + 3);
+      stats.convexQuads++;
+    } else if (ClipPolygon(
+                   controlPoints, polygonVertices, polygonStart, polygonSize, polygonIndex)) {
+      if (polygonSize == 4) {
+        stats.concaveQuads++;
+      } else {
+        stats.clippedPolygons++;
+      }
+    } else {
+      stats.failedPolygons++;
+    }
+  }
+}
+
+void FbxMeshTriangulation::AddTriangle(
+    const int polygonIndex,
+    const int corner0,
+    const int corner1,
+    const int corner2) {
+  trianglePolygons.push_back(polygonIndex);
+  triangleCorners.push_back(corner0);
+  triangleCorners.push_back(corner1);
+  triangleCorners.push_back(corner2);
+}
+
+bool FbxMeshTriangulation::ClipPolygon(
+    const FbxVector4* controlPoints,
+    const int* polygonVertices,
+    const int polygonStart,
+    const int polygonSize,
+    const int polygonIndex) {
+  const int* corners = &polygonVertices[polygonStart];
+  const FbxVector4 normal = GetPolygonNormal(controlPoints, corners, polygonSize);
+
+  // Project onto the coordinate plane the polygon faces the most, keeping it counter-clockwise.
+  int axis = 0;
+  for (int i = 1; i < 3; i++) {
+    if (std::fabs(normal[i]) > std::fabs(normal[axis])) {
+      axis = i;
+    }
+  }
+  if (normal[axis] == 0.0) {
+    return false;
+  }
+  const int uAxis = (axis + 1) % 3;
+  const int vAxis = (axis + 2) % 3;
+  const double vSign = (normal[axis] > 0.0) ? 1.0 : -1.0;
+  projectedU.resize(polygonSize);
+  projectedV.resize(polygonSize);
+  remaining.resize(polygonSize);
+  double extent = 0.0;
+  for (int i = 0; i < polygonSize; i++) {
+    projectedU[i] = controlPoints[corners[i]][uAxis];
+    projectedV[i] = controlPoints[corners[i]][vAxis] * vSign;
+    remaining[i] = i;
+    extent = std::max(extent, std::fabs(projectedU[i] - projectedU[0]));
+    extent = std::max(extent, std::fabs(projectedV[i] - projectedV[0]));
+  }
+  const auto turn = [this](const int a, const int b, const int c) {
+    return (projectedU[b] - projectedU[a]) * (projectedV[c] - projectedV[a]) -
+        (projectedV[b] - projectedV[a]) * (projectedU[c] - projectedU[a]);
+  };
+  // Turns this close to zero are taken to be straight; this covers the rounding of the projection
+  // and of turn() itself, so points on an edge are never mistaken for points beside it.
+  const double epsilon = 1e-10 * extent * extent;
+
+  const size_t firstTriangle = trianglePolygons.size();
+  size_t cursor = 0;
+  while (remaining.size() > 3) {
+    bool clipped = false;
+    for (size_t attempt = 0; attempt < remaining.size() && !clipped; attempt++) {
+      const size_t count = remaining.size();
+      const size_t i = (cursor + attempt) % count;
+      const int prev = remaining[(i + count - 1) % count];
+      const int ear = remaining[i];
+      const int next = remaining[(i + 1) % count];
+      const double earTurn = turn(prev, ear, next);
+      if (std::fabs(earTurn) <= epsilon) {
+        // a zero-area ear: drop the corner without emitting a triangle
+        remaining.erase(remaining.begin() + i);
+        cursor = i;
+        clipped = true;
+        continue;
+      }
+      if (!(earTurn > 0.0)) {
+        continue; // reflex corner
+      }
+      bool empty = true;
+      for (size_t j = 0; j < count && empty; j++) {
+        const int other = remaining[j];
+        if (other != prev && other != ear && other != next) {
+          empty = turn(prev, ear, other) < -epsilon || turn(ear, next, other) < -epsilon ||
+              turn(next, prev, other) < -epsilon;
+        }
+      }
+      if (empty) {
+        AddTriangle(polygonIndex, polygonStart + prev, polygonStart + ear, polygonStart + next);
+        remaining.erase(remaining.begin() + i);
+        cursor = i;
+        clipped = true;
+      }
+    }
+    if (!clipped) {
+      // self-intersecting: drop what we have so far
+      trianglePolygons.resize(firstTriangle);
+      triangleCorners.resize(firstTriangle * 3);
+      return false;
+    }
+  }
+  AddTriangle(
+      polygonIndex,
+      polygonStart + remaining[0],
+      polygonStart + remaining[1],
+      polygonStart + remaining[2]);
+  return true;
+}
@@ -0,0 +1,78 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "FBX2glTF.h"
+
+/**
+ * Splits the polygons of a FbxMesh into triangles without touching the mesh itself, so that its
+ * layers can be read as they are rather than rebuilt by FbxGeometryConverter. Triangles are kept,
+ * convex quads are split along their first diagonal and everything else, concave quads included, is
+ * ear-clipped in the polygon's plane. Corners on a straight line with their neighbours, such as
+ * T-junction vertices, are clipped as zero-area ears and produce no triangle. Polygons without area
+ * or that intersect themselves cannot be clipped; when there are any, NeedsFallback() asks for the
+ * mesh to be triangulated by the SDK.
+ *
+ * Triangles refer to the polygon they came from and to the mesh's polygon vertices, so the usual
+ * per-polygon and per-polygon-vertex layer lookups keep working on them.
+ */
+class FbxMeshTriangulation {
+ public:
+  struct Stats {
+    int triangles = 0;
+    int convexQuads = 0;
+    int concaveQuads = 0;
+    int clippedPolygons = 0;
+    int failedPolygons = 0;
+    int skippedPolygons = 0; // fewer than three vertices
+  };
+
+  explicit FbxMeshTriangulation(const FbxMesh* pMesh);
+
+  bool NeedsFallback() const {
+    return stats.failedPolygons > 0;
+  }
+
+  const Stats& GetStats() const {
+    return stats;
+  }
+
+  int GetTriangleCount() const {
+    return (int)trianglePolygons.size();
+  }
+
+  int GetPolygonIndex(const int triangleIndex) const {
+    return trianglePolygons[triangleIndex];
+  }
+
+  // The index into FbxMesh::GetPolygonVertices() of one of the triangle's three corners.
+  int GetPolygonVertexIndex(const int triangleIndex, const int cornerIndex) const {
+    return triangleCorners[triangleIndex * 3 + cornerIndex];
+  }
+
+ private:
+  bool ClipPolygon(
+      const FbxVector4* controlPoints,
+      const int* polygonVertices,
+      const int polygonStart,
+      const int polygonSize,
+      const int polygonIndex);
+  void AddTriangle(const int polygonIndex, const int corner0, const int corner1, const int corner2);
+
+  Stats stats;
+  std::vector<int> trianglePolygons;
+  std::vector<int> triangleCorners;
+
+  // scratch space for ClipPolygon()
+  std::vector<double> projectedU;
+  std::vector<double> projectedV;
+  std::vector<int> remaining;
+};
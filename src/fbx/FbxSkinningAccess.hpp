@@ -63,7 +63,7 @@ class FbxSkinningAccess {
     return inverseBindMatrices[jointIndex];
   }
 
-  const std::vector<FbxVertexSkinningInfo> GetVertexSkinningInfo(const int controlPointIndex) const {
+  const std::vector<FbxVertexSkinningInfo>& GetVertexSkinningInfo(const int controlPointIndex) const {
     return vertexSkinning[controlPointIndex];
   }
 
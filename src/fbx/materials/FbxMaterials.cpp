@@ -16,7 +16,8 @@ static int warnMtrCount = 0;
 
 FbxMaterialsAccess::FbxMaterialsAccess(
     const FbxMesh* pMesh,
-    const std::map<const FbxTexture*, FbxString>& textureLocations)
+    const std::map<const FbxTexture*, FbxString>& textureLocations,
+    const bool readUserProperties)
     : mappingMode(FbxGeometryElement::eNone), mesh(nullptr), indices(nullptr) {
   if (pMesh->GetElementMaterialCount() <= 0) {
     return;
@@ -70,7 +71,7 @@ FbxMaterialsAccess::FbxMaterialsAccess(
     if (materialNum >= userProperties.size()) {
       userProperties.resize(materialNum + 1);
     }
-    if (surfaceMaterial && userProperties[materialNum].empty()) {
+    if (readUserProperties && surfaceMaterial && userProperties[materialNum].empty()) {
 
       FbxProperty objectProperty = surfaceMaterial->GetFirstProperty();
       while (objectProperty.IsValid()) {
@@ -83,29 +84,33 @@ FbxMaterialsAccess::FbxMaterialsAccess(
   }
 }
 
-const std::shared_ptr<FbxMaterialInfo> FbxMaterialsAccess::GetMaterial(
-    const int polygonIndex) const {
+int FbxMaterialsAccess::GetMaterialSlot(const int polygonIndex) const {
   if (mappingMode != FbxGeometryElement::eNone) {
     const int materialNum =
         indices->GetAt((mappingMode == FbxGeometryElement::eByPolygon) ? polygonIndex : 0);
     if (materialNum < 0 || materialNum >= summaries.size()) {
-      return nullptr;
+      return -1;
     }
-    return summaries.at((unsigned long)materialNum);
+    return materialNum;
   }
-  return nullptr;
+  return -1;
+}
+
+const std::shared_ptr<FbxMaterialInfo> FbxMaterialsAccess::GetMaterial(
+    const int polygonIndex) const {
+  const int materialNum = GetMaterialSlot(polygonIndex);
+  if (materialNum < 0) {
+    return nullptr;
+  }
+  return summaries.at((unsigned long)materialNum);
 }
 
 const std::vector<std::string> FbxMaterialsAccess::GetUserProperties(const int polygonIndex) const {
-  if (mappingMode != FbxGeometryElement::eNone) {
-    const int materialNum =
-        indices->GetAt((mappingMode == FbxGeometryElement::eByPolygon) ? polygonIndex : 0);
-    if (materialNum < 0 || materialNum >= summaries.size()) {
-      return std::vector<std::string>();
-    }
-    return userProperties.at((unsigned long)materialNum);
+  const int materialNum = GetMaterialSlot(polygonIndex);
+  if (materialNum < 0) {
+    return std::vector<std::string>();
   }
-  return std::vector<std::string>();
+  return userProperties.at((unsigned long)materialNum);
 }
 
 std::unique_ptr<FbxMaterialInfo> FbxMaterialsAccess::GetMaterialInfo(
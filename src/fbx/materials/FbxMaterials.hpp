@@ -43,7 +43,16 @@ class FbxMaterialsAccess {
  public:
   FbxMaterialsAccess(
       const FbxMesh* pMesh,
-      const std::map<const FbxTexture*, FbxString>& textureLocations);
+      const std::map<const FbxTexture*, FbxString>& textureLocations,
+      const bool readUserProperties);
+
+  // The index of the mesh material slot a polygon uses, or -1 if it has none. Polygons that share
+  // a slot share their material and user properties.
+  int GetMaterialSlot(const int polygonIndex) const;
+
+  int GetMaterialSlotCount() const {
+    return (int)summaries.size();
+  }
 
   const std::shared_ptr<FbxMaterialInfo> GetMaterial(const int polygonIndex) const;
 
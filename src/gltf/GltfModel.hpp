@@ -144,9 +144,10 @@ class GltfModel {
       const RawModel& surfaceModel,
       PrimitiveData& primitive,
       const AttributeDefinition<T>& attrDef) {
-    // copy attribute data into vector
-    std::vector<T> attribArr;
-    surfaceModel.GetAttributeArray<T>(attribArr, attrDef.rawAttributeIx);
+    // the model's vertex stream for this attribute, or a copy gathered into scratch
+    std::vector<T> scratch;
+    const std::vector<T>& attribArr =
+        surfaceModel.GetAttributeArray<T>(scratch, attrDef.rawAttributeIx);
 
     std::shared_ptr<AccessorData> accessor;
 #ifdef USE_DRACO
@@ -172,9 +173,10 @@ class GltfModel {
       const RawModel& surfaceModel,
       PrimitiveData& primitive,
       const AttributeArrayDefinition<T>& attrDef) {
-    // copy attribute data into vector
-    std::vector<T> attribArr;
-    surfaceModel.GetArrayAttributeArray<T>(attribArr, attrDef.rawAttributeIx, attrDef.arrayOffset);
+    // the model's vertex stream for this attribute, or a copy gathered into scratch
+    std::vector<T> scratch;
+    const std::vector<T>& attribArr = surfaceModel.GetArrayAttributeArray<T>(
+        scratch, attrDef.rawAttributeIx, attrDef.arrayOffset);
 
     std::shared_ptr<AccessorData> accessor;
 #ifdef USE_DRACO
@@ -9,6 +9,7 @@
 #include "Raw2Gltf.hpp"
 
 #include <cassert>
+#include <cmath>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
@@ -65,6 +66,57 @@ T& require(std::map<long, std::shared_ptr<T>> map, long key) {
   return result;
 }
 
+// Rotations as normalized shorts, which glTF decodes as max(c / 32767, -1); maxErrorDegrees grows
+// to the largest angle between a rotation and what it decodes to.
+static std::vector<mathfu::Vector<int16_t, 4>> quantizeRotations(
+    const std::vector<Quatf>& rotations,
+    double& maxErrorDegrees) {
+  std::vector<mathfu::Vector<int16_t, 4>> result;
+  result.reserve(rotations.size());
+  for (const Quatf& rotation : rotations) {
+    const double components[4] = {
+        rotation.vector()[0], rotation.vector()[1], rotation.vector()[2], rotation.scalar()};
+    int16_t quantized[4];
+    double dot = 0.0, lengthSquared = 0.0, decodedLengthSquared = 0.0;
+    for (int ii = 0; ii < 4; ii++) {
+      const double component = std::max(-1.0, std::min(1.0, components[ii]));
+      quantized[ii] = (int16_t)std::lround(component * 32767.0);
+      const double decoded = std::max(quantized[ii] / 32767.0, -1.0);
+      dot += components[ii] * decoded;
+      lengthSquared += components[ii] * components[ii];
+      decodedLengthSquared += decoded * decoded;
+    }
+    const double cosHalfError =
+        std::min(1.0, std::fabs(dot) / std::sqrt(lengthSquared * decodedLengthSquared));
+    maxErrorDegrees = std::max(maxErrorDegrees, 2.0 * std::acos(cosHalfError) * 180.0 / M_PI);
+    result.emplace_back(quantized[0], quantized[1], quantized[2], quantized[3]);
+  }
+  return result;
+}
+
+// Weights as normalized unsigned integers of the given number of bits, or false if any of them lies
+// outside of [0, 1]; maxError grows to the largest difference between a weight and what it decodes
+// to.
+static bool quantizeWeights(
+    const std::vector<float>& weights,
+    const int bits,
+    std::vector<uint32_t>& result,
+    double& maxError) {
+  const double scale = (double)((1u << bits) - 1);
+  double error = 0.0;
+  result.clear();
+  result.reserve(weights.size());
+  for (const float weight : weights) {
+    if (!(weight >= 0.0f && weight <= 1.0f)) {
+      return false;
+    }
+    result.push_back((uint32_t)std::lround(weight * scale));
+    error = std::max(error, std::fabs(result.back() / scale - weight));
+  }
+  maxError = std::max(maxError, error);
+  return true;
+}
+
 static const std::vector<TriangleIndex> getIndexArray(const RawModel& raw) {
   std::vector<TriangleIndex> result;
 
@@ -105,6 +157,13 @@ ModelData* Raw2Gltf(
 
   if (verboseOutput) {
     fmt::printf("%7d vertices\n", raw.GetVertexCount());
+    if (raw.GetVertexCount() > 0) {
+      const size_t collisions = raw.GetVertexHashCollisionCount();
+      fmt::printf(
+          "%7lu vertex hash collisions (%.2f%%)\n",
+          collisions,
+          100.0 * collisions / raw.GetVertexCount());
+    }
     fmt::printf("%7d triangles\n", raw.GetTriangleCount());
     fmt::printf("%7d textures\n", raw.GetTextureCount());
     fmt::printf("%7d nodes\n", raw.GetNodeCount());
@@ -153,17 +212,35 @@ ModelData* Raw2Gltf(
     // animations
     //
 
+    // what --anim-quantize costs in precision, and saves in size
+    size_t quantizedAccessorCount = 0;
+    size_t quantizedBytesSaved = 0;
+    double maxRotationErrorDegrees = 0.0;
+    double maxWeightError = 0.0;
+
     for (int i = 0; i < raw.GetAnimationCount(); i++) {
       const RawAnimation& animation = raw.GetAnimation(i);
 
-      if (animation.times.size() == 0)
+      if (animation.times.size() == 0 || animation.channels.empty())
         continue;
 
-      auto accessor = gltf->AddAccessorAndView(buffer, GLT_FLOAT, animation.times);
-      accessor->min = {*std::min_element(std::begin(animation.times), std::end(animation.times))};
-      accessor->max = {*std::max_element(std::begin(animation.times), std::end(animation.times))};
+      AnimationData& aDat = *gltf->animations.hold(new AnimationData(animation.name));
+
+      // Tracks without times of their own use the animation's. Time accessors are only written once
+      // a track needs them, and are shared by every track with the same times, so reduced tracks
+      // leave no unused accessor behind.
+      std::map<std::vector<float>, std::shared_ptr<AccessorData>> timeAccessors;
+      const auto getTimeAccessor = [&](const std::vector<float>& times) -> const AccessorData& {
+        const std::vector<float>& trackTimes = times.empty() ? animation.times : times;
+        auto& timeAccessor = timeAccessors[trackTimes];
+        if (timeAccessor == nullptr) {
+          timeAccessor = gltf->AddAccessorAndView(buffer, GLT_FLOAT, trackTimes);
+          timeAccessor->min = {*std::min_element(std::begin(trackTimes), std::end(trackTimes))};
+          timeAccessor->max = {*std::max_element(std::begin(trackTimes), std::end(trackTimes))};
+        }
+        return *timeAccessor;
+      };
 
-      AnimationData& aDat = *gltf->animations.hold(new AnimationData(animation.name, *accessor));
       if (verboseOutput) {
         fmt::printf(
             "Animation '%s' has %lu channels:\n",
@@ -190,26 +267,71 @@ ModelData* Raw2Gltf(
         if (!channel.translations.empty()) {
           aDat.AddNodeChannel(
               nDat,
+              getTimeAccessor(channel.translationTimes),
               *gltf->AddAccessorAndView(buffer, GLT_VEC3F, channel.translations),
-              "translation");
+              "translation",
+              channel.translationInterpolation);
         }
         if (!channel.rotations.empty()) {
+          std::shared_ptr<AccessorData> rotationAccessor;
+          // cubic spline tangents need not fit in [-1, 1]
+          if (options.animationQuantization.enabled &&
+              channel.rotationInterpolation != RAW_INTERPOLATION_CUBICSPLINE) {
+            rotationAccessor = gltf->AddAccessorAndView(
+                buffer, GLT_QUATS, quantizeRotations(channel.rotations, maxRotationErrorDegrees));
+            rotationAccessor->normalized = true;
+            quantizedAccessorCount++;
+            quantizedBytesSaved += channel.rotations.size() *
+                (GLT_QUATF.byteStride() - GLT_QUATS.byteStride());
+          } else {
+            rotationAccessor = gltf->AddAccessorAndView(buffer, GLT_QUATF, channel.rotations);
+          }
           aDat.AddNodeChannel(
-              nDat, *gltf->AddAccessorAndView(buffer, GLT_QUATF, channel.rotations), "rotation");
+              nDat,
+              getTimeAccessor(channel.rotationTimes),
+              *rotationAccessor,
+              "rotation",
+              channel.rotationInterpolation);
         }
         if (!channel.scales.empty()) {
           aDat.AddNodeChannel(
-              nDat, *gltf->AddAccessorAndView(buffer, GLT_VEC3F, channel.scales), "scale");
+              nDat,
+              getTimeAccessor(channel.scaleTimes),
+              *gltf->AddAccessorAndView(buffer, GLT_VEC3F, channel.scales),
+              "scale",
+              channel.scaleInterpolation);
         }
         if (!channel.weights.empty()) {
-          aDat.AddNodeChannel(
-              nDat,
-              *gltf->AddAccessorAndView(buffer, {CT_FLOAT, 1, "SCALAR"}, channel.weights),
-              "weights");
+          std::shared_ptr<AccessorData> weightAccessor;
+          std::vector<uint32_t> quantizedWeights;
+          const int weightBits = options.animationQuantization.weightBits;
+          if (options.animationQuantization.enabled &&
+              quantizeWeights(channel.weights, weightBits, quantizedWeights, maxWeightError)) {
+            const GLType weightType = {(weightBits == 8) ? CT_UBYTE : CT_USHORT, 1, "SCALAR"};
+            weightAccessor = gltf->AddAccessorAndView(buffer, weightType, quantizedWeights);
+            weightAccessor->normalized = true;
+            quantizedAccessorCount++;
+            quantizedBytesSaved +=
+                channel.weights.size() * (CT_FLOAT.size - weightType.componentType.size);
+          } else {
+            weightAccessor =
+                gltf->AddAccessorAndView(buffer, {CT_FLOAT, 1, "SCALAR"}, channel.weights);
+          }
+          aDat.AddNodeChannel(nDat, getTimeAccessor(animation.times), *weightAccessor, "weights");
         }
       }
     }
 
+    if (verboseOutput && options.animationQuantization.enabled) {
+      fmt::printf(
+          "Quantized %lu animation accessors, saving %3.1f MB; largest errors: %.4f degrees of "
+          "rotation, %.6f of weight.\n",
+          quantizedAccessorCount,
+          (float)quantizedBytesSaved * 1e-6f,
+          maxRotationErrorDegrees,
+          maxWeightError);
+    }
+
     //
     // samplers
     //
@@ -427,8 +549,9 @@ ModelData* Raw2Gltf(
       }
     }
 
-    for (const auto& surfaceModel : materialModels) {
+    for (auto& surfaceModel : materialModels) {
       assert(surfaceModel.GetSurfaceCount() == 1);
+      surfaceModel.BuildVertexStreams();
       const RawSurface& rawSurface = surfaceModel.GetSurface(0);
       const long surfaceId = rawSurface.id;
 
@@ -630,6 +753,7 @@ ModelData* Raw2Gltf(
                 buffer, surfaceModel, *primitive, ATTR_WEIGHTS);
           }
         }
+        surfaceModel.ReleaseVertexStreams();
 
         // each channel present in the mesh always ends up a target in the primitive
         for (int channelIx = 0; channelIx < rawSurface.blendChannels.size(); channelIx++) {
@@ -643,31 +767,45 @@ ModelData* Raw2Gltf(
 
           std::vector<TriangleIndex> sparseIndices;
 
-          for (int jj = 0; jj < surfaceModel.GetVertexCount(); jj++) {
-            auto blendVertex = surfaceModel.GetVertex(jj).blends[channelIx];
+          const bool useNormals = options.useBlendShapeNormals && channel.hasNormals;
+          const bool useTangents = options.useBlendShapeTangents && channel.hasTangents;
+
+          // vertices the channel does not list are left in place
+          if (channel.vertexIndices.size() < (size_t)surfaceModel.GetVertexCount()) {
+            shapeBounds.AddPoint(Vec3f(0.0f));
+          }
+          if (options.disableSparseBlendShapes) {
+            // If sparse is off, add all vertices
+            positions.resize(surfaceModel.GetVertexCount(), Vec3f(0.0f));
+            if (useNormals) {
+              normals.resize(surfaceModel.GetVertexCount(), Vec3f(0.0f));
+            }
+            if (useTangents) {
+              tangents.resize(surfaceModel.GetVertexCount(), Vec4f(0.0f));
+            }
+          }
+          for (size_t jj = 0; jj < channel.vertexIndices.size(); jj++) {
+            const int vertexIndex = channel.vertexIndices[jj];
+            const RawBlendVertex& blendVertex = channel.deltas[jj];
             shapeBounds.AddPoint(blendVertex.position);
-            bool isSparseVertex =
-                options.disableSparseBlendShapes; // If sparse is off, add all vertices
-            // Check to see whether position, normal or tangent deviates from base mesh and flag as
-            // sparse.
-            if (blendVertex.position.Length() > 0.00) {
-              isSparseVertex = true;
+            if (options.disableSparseBlendShapes) {
+              positions[vertexIndex] = blendVertex.position;
+              if (useNormals) {
+                normals[vertexIndex] = blendVertex.normal;
+              }
+              if (useTangents) {
+                tangents[vertexIndex] = blendVertex.tangent;
+              }
+              continue;
             }
-            //            if (options.useBlendShapeNormals && channel.hasNormals &&
-            //                blendVertex.normal.Length() > 0.00) {
-            //              isSparseVertex = true;
-            //            }
-            //            if (options.useBlendShapeTangents && channel.hasTangents &&
-            //                blendVertex.tangent.Length() > 0.00) {
-            //              isSparseVertex = true;
-            //            }
-            if (isSparseVertex == true) {
-              sparseIndices.push_back(jj);
+            // Only vertices whose position deviates from the base mesh go in the sparse accessor.
+            if (blendVertex.position.Length() > 0.00) {
+              sparseIndices.push_back(vertexIndex);
               positions.push_back(blendVertex.position);
-              if (options.useBlendShapeNormals && channel.hasNormals) {
+              if (useNormals) {
                 normals.push_back(blendVertex.normal);
               }
-              if (options.useBlendShapeTangents && channel.hasTangents) {
+              if (useTangents) {
                 tangents.push_back(blendVertex.tangent);
               }
             }
@@ -42,6 +42,8 @@ struct ComponentType {
   const unsigned int size;
 };
 
+const ComponentType CT_UBYTE = {ComponentType::GL_UNSIGNED_BYTE, 1};
+const ComponentType CT_SHORT = {ComponentType::GL_SHORT, 2};
 const ComponentType CT_USHORT = {ComponentType::GL_UNSIGNED_SHORT, 2};
 const ComponentType CT_UINT = {ComponentType::GL_UNSIGNED_INT, 4};
 const ComponentType CT_FLOAT = {ComponentType::GL_FLOAT, 4};
@@ -116,6 +118,7 @@ const GLType GLT_MAT2F = {CT_USHORT, 4, "MAT2"};
 const GLType GLT_MAT3F = {CT_USHORT, 9, "MAT3"};
 const GLType GLT_MAT4F = {CT_FLOAT, 16, "MAT4"};
 const GLType GLT_QUATF = {CT_FLOAT, 4, "VEC4"};
+const GLType GLT_QUATS = {CT_SHORT, 4, "VEC4"};
 
 /**
  * The base of any indexed glTF entity.
@@ -167,7 +170,7 @@ struct AttributeDefinition {
 template <class T>
 struct AttributeArrayDefinition {
   const std::string gltfName;
-  const std::vector<T> RawVertex::*rawAttributeIx;
+  const RawJointArray<T> RawVertex::*rawAttributeIx;
   const GLType glType;
   const int arrayOffset;
 #ifdef USE_DRACO
@@ -176,7 +179,7 @@ struct AttributeArrayDefinition {
 #endif
   AttributeArrayDefinition(
       const std::string gltfName,
-      const std::vector<T> RawVertex::*rawAttributeIx,
+      const RawJointArray<T> RawVertex::*rawAttributeIx,
       const GLType& _glType,
 #ifdef USE_DRACO
       const draco::GeometryAttribute::Type dracoAttribute,
@@ -16,6 +16,7 @@ AccessorData::AccessorData(const BufferViewData& bufferView, GLType type, std::s
       byteOffset(0),
       count(0),
       name(name),
+      normalized(false),
       sparse(false) {}
 
 AccessorData::AccessorData(const AccessorData& baseAccessor, const BufferViewData& sparseIdxBufferView, const BufferViewData& sparseDataBufferView, GLType type, std::string name)
@@ -25,6 +26,7 @@ AccessorData::AccessorData(const AccessorData& baseAccessor, const BufferViewDat
       byteOffset(baseAccessor.byteOffset),
       count(baseAccessor.count),
       name(name),
+      normalized(baseAccessor.normalized),
       sparse(true),
       sparseIdxCount(sparseIdxBufferView.count),
       sparseIdxBufferView(sparseIdxBufferView.ix),
@@ -34,7 +36,13 @@ AccessorData::AccessorData(const AccessorData& baseAccessor, const BufferViewDat
       sparseDataBufferViewOffset(0) {}
 
 AccessorData::AccessorData(GLType type)
-    : Holdable(), bufferView(-1), type(std::move(type)), byteOffset(0), count(0) {}
+    : Holdable(),
+      bufferView(-1),
+      type(std::move(type)),
+      byteOffset(0),
+      count(0),
+      normalized(false),
+      sparse(false) {}
 
 json AccessorData::serialize() const {
   json result{
@@ -49,6 +57,9 @@ json AccessorData::serialize() const {
   if (!max.empty()) {
     result["max"] = max;
   }
+  if (normalized) {
+    result["normalized"] = true;
+  }
   if (sparse) {
     json sparseData = {{"count", sparseIdxCount}};
     sparseData["indices"] = { {"bufferView", sparseIdxBufferView},
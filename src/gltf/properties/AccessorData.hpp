@@ -29,6 +29,8 @@ struct AccessorData : Holdable {
     std::vector<float> min;
     std::vector<float> max;
     std::string name;
+    // whether integer components stand for values in [0, 1], or [-1, 1] if signed
+    bool normalized;
 
     bool sparse;
     int sparseIdxCount;
@@ -13,19 +13,20 @@
 #include "AccessorData.hpp"
 #include "NodeData.hpp"
 
-AnimationData::AnimationData(std::string name, const AccessorData& timeAccessor)
-    : Holdable(), name(std::move(name)), timeAccessor(timeAccessor.ix) {}
+AnimationData::AnimationData(std::string name) : Holdable(), name(std::move(name)) {}
 
 // assumption: 1-to-1 relationship between channels and samplers; this is a simplification on what
 // glTF can express, but it means we can rely on samplerIx == channelIx throughout an animation
 void AnimationData::AddNodeChannel(
     const NodeData& node,
+    const AccessorData& timeAccessor,
     const AccessorData& accessor,
-    std::string path) {
+    std::string path,
+    RawInterpolation interpolation) {
   assert(channels.size() == samplers.size());
   uint32_t ix = to_uint32(channels.size());
   channels.emplace_back(channel_t(ix, node, std::move(path)));
-  samplers.emplace_back(sampler_t(timeAccessor, accessor.ix));
+  samplers.emplace_back(sampler_t(timeAccessor.ix, accessor.ix, interpolation));
 }
 
 json AnimationData::serialize() const {
@@ -35,7 +36,11 @@ json AnimationData::serialize() const {
 AnimationData::channel_t::channel_t(uint32_t ix, const NodeData& node, std::string path)
     : ix(ix), node(node.ix), path(std::move(path)) {}
 
-AnimationData::sampler_t::sampler_t(uint32_t time, uint32_t output) : time(time), output(output) {}
+AnimationData::sampler_t::sampler_t(
+    uint32_t time,
+    uint32_t output,
+    RawInterpolation interpolation)
+    : time(time), output(output), interpolation(interpolation) {}
 
 void to_json(json& j, const AnimationData::channel_t& data) {
   j = json{{"sampler", data.ix},
@@ -46,9 +51,20 @@ void to_json(json& j, const AnimationData::channel_t& data) {
 }
 
 void to_json(json& j, const AnimationData::sampler_t& data) {
+  const char* interpolation = "LINEAR";
+  switch (data.interpolation) {
+    case RAW_INTERPOLATION_LINEAR:
+      break;
+    case RAW_INTERPOLATION_STEP:
+      interpolation = "STEP";
+      break;
+    case RAW_INTERPOLATION_CUBICSPLINE:
+      interpolation = "CUBICSPLINE";
+      break;
+  }
   j = json{
       {"input", data.time},
-      {"interpolation", "LINEAR"},
+      {"interpolation", interpolation},
       {"output", data.output},
   };
 }
@@ -9,10 +9,12 @@
 #include "RawModel.hpp"
 
 #include <cmath>
+#include <cstring>
 #include <map>
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <tuple>
 
@@ -22,13 +24,88 @@
 
 #include "utils/Image_Utils.hpp"
 #include "utils/String_Utils.hpp"
+#include "utils/Thread_Utils.hpp"
 
+static inline void HashCombine(size_t& seed, const size_t value) {
+  seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+// Floats are hashed by bit pattern, which is exact for everything operator== considers equal
+// except for the two zeroes; fold -0.0f onto 0.0f so equal vertices always share a hash.
+static inline void HashFloat(size_t& seed, const float value) {
+  uint32_t bits = 0;
+  if (value != 0.0f) {
+    memcpy(&bits, &value, sizeof(bits));
+  }
+  HashCombine(seed, bits);
+}
+
+template <class T, int d>
+static inline void HashVector(size_t& seed, const mathfu::Vector<T, d>& v) {
+  for (int ii = 0; ii < d; ii++) {
+    HashFloat(seed, (float)v[ii]);
+  }
+}
+
+static inline void HashVector(size_t& seed, const Vec4i& v) {
+  for (int ii = 0; ii < 4; ii++) {
+    HashCombine(seed, v[ii]);
+  }
+}
+
+// Must fold in exactly the members that RawVertex::operator== compares.
 size_t VertexHasher::operator()(const RawVertex& v) const {
   size_t seed = 5381;
-  const auto hasher = std::hash<float>{};
-  seed ^= hasher(v.position[0]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-  seed ^= hasher(v.position[1]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-  seed ^= hasher(v.position[2]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+  HashVector(seed, v.position);
+  HashVector(seed, v.normal);
+  HashVector(seed, v.binormal);
+  HashVector(seed, v.tangent);
+  HashVector(seed, v.color);
+  HashVector(seed, v.uv0);
+  HashVector(seed, v.uv1);
+  for (const auto& jointIndices : v.jointIndices) {
+    HashVector(seed, jointIndices);
+  }
+  for (const auto& jointWeights : v.jointWeights) {
+    HashVector(seed, jointWeights);
+  }
+  HashCombine(seed, v.polarityUv0 ? 1 : 0);
+  HashCombine(seed, (size_t)v.blendSurfaceIx);
+  HashCombine(seed, (size_t)v.blendControlPointIx);
+  HashCombine(seed, (size_t)v.blendDeltaSetIx);
+  return seed;
+}
+
+// Must fold in only what AddTexture compares, so case-insensitively equal names hash alike.
+static size_t HashTextureKey(
+    const std::string& name,
+    const std::string& fileLocation,
+    const RawTextureUsage usage) {
+  size_t seed = 5381;
+  HashCombine(seed, std::hash<std::string>()(StringUtils::ToLower(name)));
+  HashCombine(seed, std::hash<std::string>()(StringUtils::ToLower(fileLocation)));
+  HashCombine(seed, (size_t)usage);
+  return seed;
+}
+
+// Must fold in only what AddMaterial compares. Of the material properties, only the shading model
+// is hashed; the rest is left to RawMatProps::operator==.
+static size_t HashMaterialKey(
+    const std::string& name,
+    const RawMaterialType materialType,
+    const RawMatProps& materialInfo,
+    const int textures[RAW_TEXTURE_USAGE_MAX],
+    const std::vector<std::string>& userProperties) {
+  size_t seed = 5381;
+  HashCombine(seed, std::hash<std::string>()(name));
+  HashCombine(seed, (size_t)materialType);
+  HashCombine(seed, (size_t)materialInfo.shadingModel);
+  for (int i = 0; i < RAW_TEXTURE_USAGE_MAX; i++) {
+    HashCombine(seed, (size_t)textures[i]);
+  }
+  for (const auto& userProperty : userProperties) {
+    HashCombine(seed, std::hash<std::string>()(userProperty));
+  }
   return seed;
 }
 
@@ -38,7 +115,9 @@ bool RawVertex::operator==(const RawVertex& other) const {
       (uv1 == other.uv1) &&
       (jointWeights == other.jointWeights) && (jointIndices == other.jointIndices) &&
       (polarityUv0 == other.polarityUv0) &&
-      (blendSurfaceIx == other.blendSurfaceIx) && (blends == other.blends);
+      (blendSurfaceIx == other.blendSurfaceIx) &&
+      (blendControlPointIx == other.blendControlPointIx) &&
+      (blendDeltaSetIx == other.blendDeltaSetIx);
 }
 /*
 bool RawVertex::operator<(const RawVertex &other) const {
@@ -98,6 +177,7 @@ size_t RawVertex::Difference(const RawVertex& other) const {
 RawModel::RawModel() : vertexAttributes(0), rootNodeId(-1) {}
 
 void RawModel::AddVertexAttribute(const RawVertexAttribute attrib) {
+  ReleaseVertexStreams();
   vertexAttributes |= attrib;
 }
 
@@ -105,12 +185,16 @@ int RawModel::AddVertex(const RawVertex& vertex) {
   /*auto it = std::find_if(vertexHash.begin(), vertexHash.end(), [&](const std::pair<RawVertex, int>& v2) -> bool {
     return vertex == v2.first;
   });*/
-  auto it = vertexHash.find(vertex);
-  if (it != vertexHash.end()) {
-    return it->second;
+  const size_t hash = VertexHasher()(vertex);
+  const auto range = vertexHash.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (vertices[it->second] == vertex) {
+      return it->second;
+    }
   }
-  vertexHash.emplace(vertex, (int)vertices.size());
+  vertexHash.emplace(hash, (int)vertices.size());
   vertices.push_back(vertex);
+  ReleaseVertexStreams();
   return (int)vertices.size() - 1;
 }
 
@@ -136,12 +220,15 @@ int RawModel::AddTexture(
   if (name.empty()) {
     return -1;
   }
-  for (size_t i = 0; i < textures.size(); i++) {
+  const size_t hash = HashTextureKey(name, fileLocation, usage);
+  const auto range = textureHash.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
     // we allocate the struct even if the implementing image file is missing
-    if (textures[i].usage == usage &&
-        StringUtils::CompareNoCase(textures[i].fileLocation, fileLocation) == 0 &&
-        StringUtils::CompareNoCase(textures[i].name, name) == 0) {
-      return (int)i;
+    const RawTexture& texture = textures[it->second];
+    if (texture.usage == usage &&
+        StringUtils::CompareNoCase(texture.fileLocation, fileLocation) == 0 &&
+        StringUtils::CompareNoCase(texture.name, name) == 0) {
+      return it->second;
     }
   }
 
@@ -171,6 +258,7 @@ int RawModel::AddTexture(
   }
   texture.fileName = fileName;
   texture.fileLocation = fileLocation;
+  textureHash.emplace(hash, (int)textures.size());
   textures.emplace_back(texture);
   return (int)textures.size() - 1;
 }
@@ -185,25 +273,6 @@ int RawModel::AddMaterial(const RawMaterial& material) {
       material.userProperties);
 }
 
-bool HasMaterialName(
-    const std::string& name,
-    std::vector<RawMaterial> materials) {
-  for (size_t i = 0; i < materials.size(); i++) {
-    if (materials[i].name == name) {
-      return true;
-    }
-  }
-  return false;
-}
-
-std::string GetUniqueMaterialName(
-    const std::string &name,
-    std::vector<RawMaterial> materials) {
-    if (HasMaterialName(name, materials)) {
-        return name + "_2";
-    }
-    return name;
-}
 int RawModel::AddMaterial(
     const long id,
     const char* name,
@@ -216,38 +285,42 @@ int RawModel::AddMaterial(
     return it->second;
   }
 
-  //fmt::printf("Material count %d, id %d\n", materials.size(), id);
-  for (size_t i = 0; i < materials.size(); i++) {
-    if (materials[i].name != name) {
+  const size_t hash = HashMaterialKey(name, materialType, *materialInfo, textures, userProperties);
+  const auto range = materialHash.equal_range(hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    const RawMaterial& candidate = materials[it->second];
+    if (candidate.name != name) {
       continue;
     }
-    if (materials[i].type != materialType) {
+    if (candidate.type != materialType) {
       continue;
     }
-    if (*(materials[i].info) != *materialInfo) {
+    if (*(candidate.info) != *materialInfo) {
       continue;
     }
     bool match = true;
     for (int j = 0; match && j < RAW_TEXTURE_USAGE_MAX; j++) {
-      match = match && (materials[i].textures[j] == textures[j]);
+      match = match && (candidate.textures[j] == textures[j]);
     }
-    if (materials[i].userProperties.size() != userProperties.size()) {
+    if (candidate.userProperties.size() != userProperties.size()) {
       match = false;
     } else {
       for (int j = 0; match && j < userProperties.size(); j++) {
-        match = match && (materials[i].userProperties[j] == userProperties[j]);
+        match = match && (candidate.userProperties[j] == userProperties[j]);
       }
     }
     if (match) {
-      materialIdToIndex[id] = i;
-      return (int)i;
+      materialIdToIndex[id] = it->second;
+      return it->second;
     }
   }
 
-
   RawMaterial material;
   material.id = id;
-  material.name = GetUniqueMaterialName(name, materials);
+  material.name = name;
+  if (materialNames.find(material.name) != materialNames.end()) {
+    material.name += "_2";
+  }
   material.type = materialType;
   material.info = materialInfo;
   material.userProperties = userProperties;
@@ -257,6 +330,8 @@ int RawModel::AddMaterial(
     material.textures[i] = textures[i];
   }
 
+  materialHash.emplace(hash, material.index);
+  materialNames.insert(material.name);
   materials.emplace_back(material);
 
   materialIdToIndex[id] = material.index;
@@ -344,13 +419,13 @@ int RawModel::AddAnimation(const RawAnimation& animation) {
 }
 
 int RawModel::AddNode(const RawNode& node) {
-  for (size_t i = 0; i < nodes.size(); i++) {
-    if (nodes[i].id == node.id) {
-      return (int)i;
-    }
+  auto it = nodeIdToIndex.find(node.id);
+  if (it != nodeIdToIndex.end()) {
+    return it->second;
   }
 
   nodes.emplace_back(node);
+  nodeIdToIndex[node.id] = (int)nodes.size() - 1;
   return (int)nodes.size() - 1;
 }
 
@@ -397,10 +472,9 @@ int RawModel::AddCameraOrthographic(
 int RawModel::AddNode(const long id, const char* name, const long parentId) {
   assert(name[0] != '\0');
 
-  for (size_t i = 0; i < nodes.size(); i++) {
-    if (nodes[i].id == id) {
-      return (int)i;
-    }
+  auto it = nodeIdToIndex.find(id);
+  if (it != nodeIdToIndex.end()) {
+    return it->second;
   }
 
   RawNode joint;
@@ -415,25 +489,98 @@ int RawModel::AddNode(const long id, const char* name, const long parentId) {
   joint.scale = Vec3f(1, 1, 1);
 
   nodes.emplace_back(joint);
+  nodeIdToIndex[id] = (int)nodes.size() - 1;
   return (int)nodes.size() - 1;
 }
 
+// Rewrite the sparse blend deltas of a surface through an old -> new vertex index mapping that
+// returns -1 for vertices that are gone, keeping the vertex indices strictly increasing.
+template <typename Remap>
+static void RemapBlendChannels(RawSurface& surface, const Remap& remap) {
+  for (auto& channel : surface.blendChannels) {
+    std::vector<std::pair<int, RawBlendVertex>> remapped;
+    remapped.reserve(channel.vertexIndices.size());
+    for (size_t i = 0; i < channel.vertexIndices.size(); i++) {
+      const int vertexIndex = remap(channel.vertexIndices[i]);
+      if (vertexIndex >= 0) {
+        remapped.emplace_back(vertexIndex, channel.deltas[i]);
+      }
+    }
+    std::sort(
+        remapped.begin(),
+        remapped.end(),
+        [](const std::pair<int, RawBlendVertex>& a, const std::pair<int, RawBlendVertex>& b) {
+          return a.first < b.first;
+        });
+    channel.vertexIndices.clear();
+    channel.deltas.clear();
+    for (const auto& entry : remapped) {
+      // vertices that merged into one share their delta set, so one copy of the delta is enough
+      if (!channel.vertexIndices.empty() && channel.vertexIndices.back() == entry.first) {
+        continue;
+      }
+      channel.AddDelta(entry.first, entry.second);
+    }
+  }
+}
+
+// Moves the entries flagged in 'keep' to the front of 'items', preserving their relative order,
+// and returns the old-to-new index table, with -1 for every entry that was dropped.
+template <typename T>
+static std::vector<int> CompactInPlace(std::vector<T>& items, const std::vector<bool>& keep) {
+  std::vector<int> remap(items.size(), -1);
+  int count = 0;
+  for (size_t i = 0; i < items.size(); i++) {
+    if (!keep[i]) {
+      continue;
+    }
+    if (count != (int)i) {
+      items[count] = std::move(items[i]);
+    }
+    remap[i] = count++;
+  }
+  items.erase(items.begin() + count, items.end());
+  return remap;
+}
+
+// Points the values of an id/hash-to-index map at the compacted indices, dropping the entries
+// whose target was removed.
+template <typename Map>
+static void RemapIndexMap(Map& indexMap, const std::vector<int>& remap) {
+  for (auto it = indexMap.begin(); it != indexMap.end();) {
+    const int newIndex = remap[it->second];
+    if (newIndex < 0) {
+      it = indexMap.erase(it);
+    } else {
+      it->second = newIndex;
+      ++it;
+    }
+  }
+}
+
 void RawModel::Condense(const int maxSkinningWeights, const bool normalizeWeights) {
+  ReleaseVertexStreams();
+
   // Only keep surfaces that are referenced by one or more triangles.
+  size_t removedSurfaces = 0;
   {
-    std::vector<RawSurface> oldSurfaces = surfaces;
-
-    surfaces.clear();
-    surfaceIdToIndex.clear();
+    std::vector<bool> used(surfaces.size(), false);
+    for (const auto& triangle : triangles) {
+      used[triangle.surfaceIndex] = true;
+    }
+    const std::vector<int> remap = CompactInPlace(surfaces, used);
+    removedSurfaces = remap.size() - surfaces.size();
 
-    std::set<int> survivingSurfaceIds;
+    std::unordered_set<long> survivingSurfaceIds;
+    for (size_t i = 0; i < surfaces.size(); i++) {
+      surfaces[i].index = (int)i;
+      survivingSurfaceIds.insert(surfaces[i].id);
+    }
     for (auto& triangle : triangles) {
-      const RawSurface& surface = oldSurfaces[triangle.surfaceIndex];
-      const int surfaceIndex = AddSurface(surface.name.c_str(), surface.id);
-      surfaces[surfaceIndex] = surface;
-      triangle.surfaceIndex = surfaceIndex;
-      survivingSurfaceIds.emplace(surface.id);
+      triangle.surfaceIndex = remap[triangle.surfaceIndex];
     }
+    RemapIndexMap(surfaceIdToIndex, remap);
+
     // clear out references to meshes that no longer exist
     for (auto& node : nodes) {
       if (node.surfaceId != 0 &&
@@ -444,51 +591,93 @@ void RawModel::Condense(const int maxSkinningWeights, const bool normalizeWeight
   }
 
   // Only keep materials that are referenced by one or more triangles.
+  size_t removedMaterials = 0;
   {
-    std::vector<RawMaterial> oldMaterials = materials;
-
-    materials.clear();
-    materialIdToIndex.clear();
+    std::vector<bool> used(materials.size(), false);
+    for (const auto& triangle : triangles) {
+      used[triangle.materialIndex] = true;
+    }
+    const std::vector<int> remap = CompactInPlace(materials, used);
+    removedMaterials = remap.size() - materials.size();
 
+    for (size_t i = 0; i < materials.size(); i++) {
+      materials[i].index = (int)i;
+    }
     for (auto& triangle : triangles) {
-      const RawMaterial& material = oldMaterials[triangle.materialIndex];
-      const int materialIndex = AddMaterial(material);
-      materials[materialIndex] = material;
-      triangle.materialIndex = materialIndex;
+      triangle.materialIndex = remap[triangle.materialIndex];
+    }
+    RemapIndexMap(materialIdToIndex, remap);
+
+    materialNames.clear();
+    for (const auto& material : materials) {
+      materialNames.insert(material.name);
     }
   }
 
   // Only keep textures that are referenced by one or more materials.
+  size_t removedTextures = 0;
   {
-    std::vector<RawTexture> oldTextures = textures;
-
-    textures.clear();
+    std::vector<bool> used(textures.size(), false);
+    for (const auto& material : materials) {
+      for (int j = 0; j < RAW_TEXTURE_USAGE_MAX; j++) {
+        if (material.textures[j] >= 0) {
+          used[material.textures[j]] = true;
+        }
+      }
+    }
+    const std::vector<int> remap = CompactInPlace(textures, used);
+    removedTextures = remap.size() - textures.size();
+    RemapIndexMap(textureHash, remap);
 
     for (auto& material : materials) {
       for (int j = 0; j < RAW_TEXTURE_USAGE_MAX; j++) {
         if (material.textures[j] >= 0) {
-          const RawTexture& texture = oldTextures[material.textures[j]];
-          const int textureIndex =
-              AddTexture(texture.name, texture.fileName, texture.fileLocation, texture.usage, texture.translation, texture.rotation, texture.scale);
-          textures[textureIndex] = texture;
-          material.textures[j] = textureIndex;
+          material.textures[j] = remap[material.textures[j]];
         }
       }
     }
   }
 
-  // Only keep vertices that are referenced by one or more triangles.
-  {
-    std::vector<RawVertex> oldVertices = vertices;
+  // Material hashes cover the texture indices, so they are recomputed for the compacted textures.
+  materialHash.clear();
+  for (const auto& material : materials) {
+    const size_t hash = HashMaterialKey(
+        material.name, material.type, *material.info, material.textures, material.userProperties);
+    materialHash.emplace(hash, material.index);
+  }
 
-    vertexHash.clear();
-    vertices.clear();
+  // Only keep vertices that are referenced by one or more triangles. The hash of a vertex does not
+  // depend on its index, so the survivors keep their vertexHash entries.
+  size_t removedVertices = 0;
+  {
+    std::vector<bool> used(vertices.size(), false);
+    for (const auto& triangle : triangles) {
+      for (int j = 0; j < 3; j++) {
+        used[triangle.verts[j]] = true;
+      }
+    }
+    const std::vector<int> remap = CompactInPlace(vertices, used);
+    removedVertices = remap.size() - vertices.size();
 
     for (auto& triangle : triangles) {
       for (int j = 0; j < 3; j++) {
-        triangle.verts[j] = AddVertex(oldVertices[triangle.verts[j]]);
+        triangle.verts[j] = remap[triangle.verts[j]];
       }
     }
+    RemapIndexMap(vertexHash, remap);
+
+    for (auto& surface : surfaces) {
+      RemapBlendChannels(surface, [&](int oldIndex) { return remap[oldIndex]; });
+    }
+  }
+
+  if (verboseOutput) {
+    fmt::printf(
+        "Condense removed %lu surfaces, %lu materials, %lu textures and %lu vertices.\n",
+        removedSurfaces,
+        removedMaterials,
+        removedTextures,
+        removedVertices);
   }
 
   {
@@ -540,6 +729,7 @@ void RawModel::Condense(const int maxSkinningWeights, const bool normalizeWeight
 }
 
 void RawModel::TransformGeometry(ComputeNormalsOption normals) {
+  ReleaseVertexStreams();
   switch (normals) {
     case ComputeNormalsOption::NEVER:
       break;
@@ -567,6 +757,7 @@ void RawModel::TransformGeometry(ComputeNormalsOption normals) {
 }
 
 void RawModel::TransformTextures(const std::vector<std::function<Vec2f(Vec2f)>>& transforms) {
+  ReleaseVertexStreams();
   for (auto& vertice : vertices) {
     if ((vertexAttributes & RAW_VERTEX_ATTRIBUTE_UV0) != 0) {
       for (const auto& fun : transforms) {
@@ -581,207 +772,888 @@ void RawModel::TransformTextures(const std::vector<std::function<Vec2f(Vec2f)>>&
   }
 }
 
-struct TriangleModelSortPos {
-  static bool Compare(const RawTriangle& a, const RawTriangle& b) {
-    if (a.materialIndex != b.materialIndex) {
-      return a.materialIndex < b.materialIndex;
+// The samples to keep, such that interpolating between consecutive kept samples reproduces all of
+// the others; error(a, b, t, sample) is how far the value at fraction t between a and b is from the
+// sample. Douglas-Peucker style: each span is split at its worst sample until all are in tolerance.
+template <typename T, typename Error>
+static std::vector<bool> SelectKeySamples(
+    const std::vector<float>& times,
+    const std::vector<T>& values,
+    const float tolerance,
+    const Error& error) {
+  std::vector<bool> keep(values.size(), false);
+  keep.front() = true;
+  keep.back() = true;
+
+  std::vector<std::pair<size_t, size_t>> spans = {{0, values.size() - 1}};
+  while (!spans.empty()) {
+    const size_t first = spans.back().first;
+    const size_t last = spans.back().second;
+    spans.pop_back();
+
+    const float duration = times[last] - times[first];
+    float worstError = tolerance;
+    size_t worst = first;
+    for (size_t ii = first + 1; ii < last; ii++) {
+      const float t = (duration > 0.0f) ? (times[ii] - times[first]) / duration : 0.0f;
+      const float sampleError = error(values[first], values[last], t, values[ii]);
+      if (sampleError > worstError) {
+        worstError = sampleError;
+        worst = ii;
+      }
     }
-    if (a.surfaceIndex != b.surfaceIndex) {
-      return a.surfaceIndex < b.surfaceIndex;
+    if (worst != first) {
+      keep[worst] = true;
+      spans.emplace_back(first, worst);
+      spans.emplace_back(worst, last);
     }
-    return a.verts[0] < b.verts[0];
   }
-};
+  return keep;
+}
+
+// Reduce values to the samples SelectKeySamples() picks, and give them their own times. Only
+// linearly interpolated tracks are reduced.
+template <typename T, typename Error>
+static void ReduceSamples(
+    const std::vector<float>& animationTimes,
+    std::vector<float>& ownTimes,
+    std::vector<T>& values,
+    const RawInterpolation interpolation,
+    const float tolerance,
+    const Error& error) {
+  const std::vector<float>& times = ownTimes.empty() ? animationTimes : ownTimes;
+  if (interpolation != RAW_INTERPOLATION_LINEAR || values.size() <= 2 ||
+      values.size() != times.size()) {
+    return;
+  }
+  const std::vector<bool> keep = SelectKeySamples(times, values, tolerance, error);
+  if (std::find(keep.begin(), keep.end(), false) == keep.end()) {
+    return;
+  }
 
-struct TriangleModelSortNeg {
-  static bool Compare(const RawTriangle& a, const RawTriangle& b) {
-    if (a.materialIndex != b.materialIndex) {
-      return a.materialIndex < b.materialIndex;
+  std::vector<float> keptTimes;
+  std::vector<T> keptValues;
+  for (size_t ii = 0; ii < values.size(); ii++) {
+    if (keep[ii]) {
+      keptTimes.push_back(times[ii]);
+      keptValues.push_back(values[ii]);
     }
-    if (a.surfaceIndex != b.surfaceIndex) {
-      return a.surfaceIndex < b.surfaceIndex;
+  }
+  ownTimes = std::move(keptTimes);
+  values = std::move(keptValues);
+}
+
+static float VectorDistance(const Vec3f& a, const Vec3f& b) {
+  return (a - b).Length();
+}
+
+// The angle, in radians, of the rotation between two unit quaternions.
+static float QuaternionAngle(const Quatf& a, const Quatf& b) {
+  const float cosHalfAngle = std::min(1.0f, std::fabs(Quatf::DotProduct(a, b)));
+  return 2.0f * std::acos(cosHalfAngle);
+}
+
+static float VectorLerpError(const Vec3f& a, const Vec3f& b, const float t, const Vec3f& sample) {
+  return VectorDistance(a + (b - a) * t, sample);
+}
+
+// The angle, in radians, between the sample and the shortest-path slerp from a to b at t, as glTF
+// viewers interpolate rotations.
+static float QuaternionSlerpError(
+    const Quatf& a,
+    const Quatf& b,
+    const float t,
+    const Quatf& sample) {
+  float cosAngle = Quatf::DotProduct(a, b);
+  const float sign = (cosAngle < 0.0f) ? -1.0f : 1.0f;
+  cosAngle *= sign;
+
+  float weightA = 1.0f - t;
+  float weightB = t * sign;
+  if (cosAngle < 0.9995f) {
+    const float angle = std::acos(cosAngle);
+    const float sinAngle = std::sin(angle);
+    weightA = std::sin((1.0f - t) * angle) / sinAngle;
+    weightB = std::sin(t * angle) / sinAngle * sign;
+  }
+  Quatf interpolated(
+      a.scalar() * weightA + b.scalar() * weightB, a.vector() * weightA + b.vector() * weightB);
+  interpolated.Normalize();
+  return QuaternionAngle(interpolated, sample);
+}
+
+void RawModel::ReduceAnimations(
+    const float positionTolerance,
+    const float angleTolerance,
+    const float scaleTolerance) {
+  const float angleToleranceRadians = angleTolerance * ((float)M_PI / 180.0f);
+  const auto countSamples = [this]() {
+    size_t count = 0;
+    for (const auto& animation : animations) {
+      for (const auto& channel : animation.channels) {
+        count += channel.translations.size() + channel.rotations.size() + channel.scales.size();
+      }
     }
-    return a.verts[0] > b.verts[0];
+    return count;
+  };
+
+  const size_t sampleCount = countSamples();
+  for (auto& animation : animations) {
+    ThreadUtils::ParallelForEach(
+        animation.channels.size(), [&](const size_t channelIndex, const size_t) {
+          RawChannel& channel = animation.channels[channelIndex];
+          ReduceSamples(
+              animation.times,
+              channel.translationTimes,
+              channel.translations,
+              channel.translationInterpolation,
+              positionTolerance,
+              VectorLerpError);
+          ReduceSamples(
+              animation.times,
+              channel.rotationTimes,
+              channel.rotations,
+              channel.rotationInterpolation,
+              angleToleranceRadians,
+              QuaternionSlerpError);
+          ReduceSamples(
+              animation.times,
+              channel.scaleTimes,
+              channel.scales,
+              channel.scaleInterpolation,
+              scaleTolerance,
+              VectorLerpError);
+        });
   }
-};
 
-void RawModel::CreateMaterialModels(
-    std::vector<RawModel>& materialModels,
-    bool shortIndices,
-    const int keepAttribs,
-    const bool forceDiscrete) const {
-  // Sort all triangles based on material first, then surface, then first vertex index.
-  std::vector<RawTriangle> sortedTriangles;
-
-  bool invertedTransparencySort = true;
-  if (invertedTransparencySort) {
-    // Split the triangles into opaque and transparent triangles.
-    std::vector<RawTriangle> opaqueTriangles;
-    std::vector<RawTriangle> transparentTriangles;
-    for (const auto& triangle : triangles) {
-      const int materialIndex = triangle.materialIndex;
-      if (materialIndex < 0) {
-        opaqueTriangles.push_back(triangle);
-        continue;
+  if (verboseOutput && sampleCount > 0) {
+    const size_t droppedCount = sampleCount - countSamples();
+    fmt::printf(
+        "Animation key reduction dropped %lu of %lu samples (%.1f%%).\n",
+        droppedCount,
+        sampleCount,
+        100.0 * droppedCount / sampleCount);
+  }
+}
+
+// Whether keeping every step-th of some evenly spaced samples, and the last, interpolates back to
+// all of them within tolerance; error() is as for SelectKeySamples().
+template <typename T, typename Error>
+static bool CanSubsample(
+    const std::vector<T>& values,
+    const size_t step,
+    const float tolerance,
+    const Error& error) {
+  const size_t last = values.size() - 1;
+  for (size_t first = 0; first < last; first += step) {
+    const size_t next = std::min(first + step, last);
+    for (size_t ii = first + 1; ii < next; ii++) {
+      const float t = (float)(ii - first) / (float)(next - first);
+      if (error(values[first], values[next], t, values[ii]) > tolerance) {
+        return false;
       }
-      const int textureIndex = materials[materialIndex].textures[RAW_TEXTURE_USAGE_DIFFUSE];
-      if (textureIndex < 0) {
-        if (vertices[triangle.verts[0]].color.w < 1.0f ||
-            vertices[triangle.verts[1]].color.w < 1.0f ||
-            vertices[triangle.verts[2]].color.w < 1.0f) {
-          transparentTriangles.push_back(triangle);
-          continue;
+    }
+  }
+  return true;
+}
+
+template <typename T>
+static void Subsample(std::vector<T>& values, const size_t step) {
+  std::vector<T> keptValues;
+  for (size_t ii = 0; ii < values.size(); ii += step) {
+    keptValues.push_back(values[ii]);
+  }
+  if ((values.size() - 1) % step != 0) {
+    keptValues.push_back(values.back());
+  }
+  values = std::move(keptValues);
+}
+
+// Subsample a track that is still sampled at the baked rate, at the times 'times', by the largest
+// of 'steps' that interpolates back to it within tolerance. Returns the rate the track ends up at,
+// or 0 for a track that was not baked.
+template <typename T, typename Error>
+static int AdaptTrackRate(
+    const std::vector<float>& times,
+    const std::vector<int>& steps,
+    const int bakedRate,
+    std::vector<float>& ownTimes,
+    std::vector<T>& values,
+    const RawInterpolation interpolation,
+    const float tolerance,
+    const Error& error) {
+  if (values.size() != times.size() || !ownTimes.empty() ||
+      interpolation != RAW_INTERPOLATION_LINEAR) {
+    return 0;
+  }
+  for (const int step : steps) {
+    if (CanSubsample(values, step, tolerance, error)) {
+      Subsample(values, step);
+      ownTimes = times;
+      Subsample(ownTimes, step);
+      return bakedRate / step;
+    }
+  }
+  return bakedRate;
+}
+
+void RawModel::AdaptAnimationRates(
+    const float positionTolerance,
+    const float angleTolerance,
+    const float scaleTolerance) {
+  const float angleToleranceRadians = angleTolerance * ((float)M_PI / 180.0f);
+
+  for (auto& animation : animations) {
+    const std::vector<float>& times = animation.times;
+    if (times.size() < 3) {
+      continue;
+    }
+    // the candidate rates are the whole numbers of frames per second the baked rate divides into,
+    // so that their samples are a subset of the baked ones
+    const int bakedRate = (int)std::lround(1.0 / (times[1] - times[0]));
+    std::vector<int> steps;
+    for (int step = bakedRate; step > 1; step--) {
+      if (bakedRate % step == 0) {
+        steps.push_back(step);
+      }
+    }
+
+    // each of a channel's translation, rotation and scale tracks gets its own rate
+    struct TrackRates {
+      int translation = 0;
+      int rotation = 0;
+      int scale = 0;
+    };
+    std::vector<TrackRates> channelRates(animation.channels.size());
+    ThreadUtils::ParallelForEach(
+        animation.channels.size(), [&](const size_t channelIndex, const size_t) {
+          RawChannel& channel = animation.channels[channelIndex];
+          TrackRates& rates = channelRates[channelIndex];
+          rates.translation = AdaptTrackRate(
+              times,
+              steps,
+              bakedRate,
+              channel.translationTimes,
+              channel.translations,
+              channel.translationInterpolation,
+              positionTolerance,
+              VectorLerpError);
+          rates.rotation = AdaptTrackRate(
+              times,
+              steps,
+              bakedRate,
+              channel.rotationTimes,
+              channel.rotations,
+              channel.rotationInterpolation,
+              angleToleranceRadians,
+              QuaternionSlerpError);
+          rates.scale = AdaptTrackRate(
+              times,
+              steps,
+              bakedRate,
+              channel.scaleTimes,
+              channel.scales,
+              channel.scaleInterpolation,
+              scaleTolerance,
+              VectorLerpError);
+        });
+
+    if (verboseOutput) {
+      fmt::printf("Animation '%s' sampling rates:\n", animation.name.c_str());
+      for (size_t channelIndex = 0; channelIndex < animation.channels.size(); channelIndex++) {
+        const char* nodeName = nodes[animation.channels[channelIndex].nodeIndex].name.c_str();
+        const TrackRates& rates = channelRates[channelIndex];
+        if (rates.translation > 0) {
+          fmt::printf("  %s translation: %d fps\n", nodeName, rates.translation);
+        }
+        if (rates.rotation > 0) {
+          fmt::printf("  %s rotation: %d fps\n", nodeName, rates.rotation);
+        }
+        if (rates.scale > 0) {
+          fmt::printf("  %s scale: %d fps\n", nodeName, rates.scale);
         }
-        opaqueTriangles.push_back(triangle);
+      }
+    }
+  }
+}
+
+// Whether every sample is within tolerance of the first; false for an empty track.
+template <typename T, typename Distance>
+static bool IsConstantTrack(
+    const std::vector<T>& values,
+    const float tolerance,
+    const Distance& distance) {
+  if (values.empty()) {
+    return false;
+  }
+  for (const T& value : values) {
+    if (distance(values.front(), value) > tolerance) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Tracks that hold the node's rest value throughout are dropped. Where a track is constant at some
+// other value, and so is the same track, at the same value, in every animation of the model, that
+// value becomes the node's rest value instead, after which those tracks can all be dropped. The
+// rest pose of skin joints, and of the nodes they inherit from, is never changed: their inverse
+// bind matrices come from the bind pose, which a folded value would no longer match.
+template <typename T, typename Distance>
+static void RemoveConstantTracks(
+    std::vector<RawAnimation>& animations,
+    std::vector<RawNode>& nodes,
+    const std::vector<bool>& restPosePinned,
+    std::vector<T> RawChannel::*track,
+    std::vector<float> RawChannel::*trackTimes,
+    RawInterpolation RawChannel::*trackInterpolation,
+    T RawNode::*restValue,
+    const float tolerance,
+    const Distance& distance,
+    size_t& removedTracks,
+    size_t& foldedTracks,
+    size_t& removedBytes) {
+  // the values of a cubic spline track are interleaved with its tangents
+  const auto isConstant = [&](const RawChannel& channel) {
+    return channel.*trackInterpolation != RAW_INTERPOLATION_CUBICSPLINE &&
+        IsConstantTrack(channel.*track, tolerance, distance);
+  };
+
+  // for each node: how many animations hold this track constant, at which value, and whether any
+  // animation holds it at another value or animates it
+  struct Constancy {
+    size_t animationCount = 0;
+    const T* value = nullptr;
+    bool foldable = true;
+  };
+  std::vector<Constancy> constancies(nodes.size());
+  for (const auto& animation : animations) {
+    for (const auto& channel : animation.channels) {
+      Constancy& constancy = constancies[channel.nodeIndex];
+      const std::vector<T>& values = channel.*track;
+      if (!isConstant(channel)) {
+        constancy.foldable = false;
         continue;
       }
-      if (textures[textureIndex].occlusion == RAW_TEXTURE_OCCLUSION_TRANSPARENT) {
-        transparentTriangles.push_back(triangle);
-      } else {
-        opaqueTriangles.push_back(triangle);
+      if (constancy.value == nullptr) {
+        constancy.value = &values.front();
+      } else if (distance(*constancy.value, values.front()) > tolerance) {
+        constancy.foldable = false;
       }
+      constancy.animationCount++;
     }
+  }
 
-    // Sort the opaque triangles.
-    std::sort(opaqueTriangles.begin(), opaqueTriangles.end(), TriangleModelSortPos::Compare);
+  for (size_t nodeIndex = 0; nodeIndex < nodes.size(); nodeIndex++) {
+    const Constancy& constancy = constancies[nodeIndex];
+    RawNode& node = nodes[nodeIndex];
+    if (!restPosePinned[nodeIndex] && constancy.foldable &&
+        constancy.animationCount == animations.size() &&
+        distance(node.*restValue, *constancy.value) > tolerance) {
+      node.*restValue = *constancy.value;
+      foldedTracks += constancy.animationCount;
+    }
+  }
 
-    // Sort the transparent triangles in the reverse direction.
-    std::sort(
-        transparentTriangles.begin(), transparentTriangles.end(), TriangleModelSortNeg::Compare);
+  for (auto& animation : animations) {
+    for (auto& channel : animation.channels) {
+      std::vector<T>& values = channel.*track;
+      if (isConstant(channel) &&
+          distance(nodes[channel.nodeIndex].*restValue, values.front()) <= tolerance) {
+        removedTracks++;
+        removedBytes += values.size() * sizeof(T) + (channel.*trackTimes).size() * sizeof(float);
+        values.clear();
+        (channel.*trackTimes).clear();
+      }
+    }
+  }
+}
 
-    // Add the triangles to the sorted list.
-    for (const auto& opaqueTriangle : opaqueTriangles) {
-      sortedTriangles.push_back(opaqueTriangle);
+void RawModel::RemoveConstantAnimationTracks(
+    const float positionTolerance,
+    const float angleTolerance,
+    const float scaleTolerance) {
+  size_t removedTracks = 0;
+  size_t foldedTracks = 0;
+  size_t removedBytes = 0;
+
+  // skin joints and their ancestors keep their rest pose
+  std::vector<bool> restPosePinned(nodes.size(), false);
+  for (const auto& node : nodes) {
+    if (!node.isJoint) {
+      continue;
     }
-    for (const auto& transparentTriangle : transparentTriangles) {
-      sortedTriangles.push_back(transparentTriangle);
+    for (int nodeIndex = GetNodeById(node.id); nodeIndex >= 0 && !restPosePinned[nodeIndex];
+         nodeIndex = GetNodeById(nodes[nodeIndex].parentId)) {
+      restPosePinned[nodeIndex] = true;
     }
-  } else {
-    sortedTriangles = triangles;
-    std::sort(sortedTriangles.begin(), sortedTriangles.end(), TriangleModelSortPos::Compare);
   }
 
-  // Overestimate the number of models that will be created to avoid massive reallocation.
-  int discreteCount = 0;
-  for (const auto& surface : surfaces) {
-    discreteCount += surface.discrete ? 1 : 0;
+  RemoveConstantTracks(
+      animations,
+      nodes,
+      restPosePinned,
+      &RawChannel::translations,
+      &RawChannel::translationTimes,
+      &RawChannel::translationInterpolation,
+      &RawNode::translation,
+      positionTolerance,
+      VectorDistance,
+      removedTracks,
+      foldedTracks,
+      removedBytes);
+  RemoveConstantTracks(
+      animations,
+      nodes,
+      restPosePinned,
+      &RawChannel::rotations,
+      &RawChannel::rotationTimes,
+      &RawChannel::rotationInterpolation,
+      &RawNode::rotation,
+      angleTolerance * ((float)M_PI / 180.0f),
+      QuaternionAngle,
+      removedTracks,
+      foldedTracks,
+      removedBytes);
+  RemoveConstantTracks(
+      animations,
+      nodes,
+      restPosePinned,
+      &RawChannel::scales,
+      &RawChannel::scaleTimes,
+      &RawChannel::scaleInterpolation,
+      &RawNode::scale,
+      scaleTolerance,
+      VectorDistance,
+      removedTracks,
+      foldedTracks,
+      removedBytes);
+
+  // channels that are left with nothing to animate go altogether
+  for (auto& animation : animations) {
+    auto& channels = animation.channels;
+    channels.erase(
+        std::remove_if(
+            channels.begin(),
+            channels.end(),
+            [](const RawChannel& channel) {
+              return channel.translations.empty() && channel.rotations.empty() &&
+                  channel.scales.empty() && channel.weights.empty();
+            }),
+        channels.end());
   }
 
-  materialModels.clear();
-  materialModels.reserve(materials.size() + discreteCount);
+  if (verboseOutput) {
+    fmt::printf(
+        "Removed %lu constant animation accessors (%lu folded into rest poses), %3.1f MB.\n",
+        removedTracks,
+        foldedTracks,
+        (float)removedBytes * 1e-6f);
+  }
+}
 
-  const RawVertex defaultVertex;
+// Stable counting sort of 'items' on key(item), which must lie in [0, keyCount).
+template <typename Key>
+static void CountingSort(
+    std::vector<int>& items,
+    std::vector<int>& scratch,
+    const size_t keyCount,
+    const Key& key) {
+  std::vector<size_t> offsets(keyCount + 1, 0);
+  for (const int item : items) {
+    offsets[key(item) + 1]++;
+  }
+  for (size_t k = 1; k <= keyCount; k++) {
+    offsets[k] += offsets[k - 1];
+  }
+  scratch.resize(items.size());
+  for (const int item : items) {
+    scratch[offsets[key(item)]++] = item;
+  }
+  items.swap(scratch);
+}
 
-  // Create a separate model for each material.
-  RawModel* model;
-  for (size_t i = 0; i < sortedTriangles.size(); i++) {
-    if (sortedTriangles[i].materialIndex < 0 || sortedTriangles[i].surfaceIndex < 0) {
-      continue;
-    }
+static int GetKeptVertexAttributes(const int keepAttribs, const RawMaterial& material) {
+  int keep = keepAttribs;
+  if ((keepAttribs & RAW_VERTEX_ATTRIBUTE_POSITION) != 0) {
+    keep |= RAW_VERTEX_ATTRIBUTE_JOINT_INDICES | RAW_VERTEX_ATTRIBUTE_JOINT_WEIGHTS;
+  }
+  if ((keepAttribs & RAW_VERTEX_ATTRIBUTE_AUTO) != 0) {
+    keep |= RAW_VERTEX_ATTRIBUTE_POSITION;
 
-    if (i == 0 || (shortIndices && model->GetVertexCount() >= 0xFFFE) ||
-        sortedTriangles[i].materialIndex != sortedTriangles[i - 1].materialIndex ||
-        (sortedTriangles[i].surfaceIndex != sortedTriangles[i - 1].surfaceIndex &&
-         (forceDiscrete || surfaces[sortedTriangles[i].surfaceIndex].discrete ||
-          surfaces[sortedTriangles[i - 1].surfaceIndex].discrete))) {
-      materialModels.resize(materialModels.size() + 1);
-      model = &materialModels[materialModels.size() - 1];
-      model->globalMaxWeights = globalMaxWeights;
+    if (material.textures[RAW_TEXTURE_USAGE_DIFFUSE] != -1) {
+      keep |= RAW_VERTEX_ATTRIBUTE_UV0;
     }
+    if (material.textures[RAW_TEXTURE_USAGE_NORMAL] != -1) {
+      keep |= RAW_VERTEX_ATTRIBUTE_NORMAL | RAW_VERTEX_ATTRIBUTE_TANGENT |
+          RAW_VERTEX_ATTRIBUTE_BINORMAL | RAW_VERTEX_ATTRIBUTE_UV0;
+    }
+    if (material.textures[RAW_TEXTURE_USAGE_SPECULAR] != -1) {
+      keep |= RAW_VERTEX_ATTRIBUTE_NORMAL | RAW_VERTEX_ATTRIBUTE_UV0;
+    }
+    if (material.textures[RAW_TEXTURE_USAGE_EMISSIVE] != -1) {
+      keep |= RAW_VERTEX_ATTRIBUTE_UV1;
+    }
+  }
+  return keep;
+}
 
-    // FIXME: will have to unlink from the nodes, transform both surfaces into a
-    // common space, and reparent to a new node with appropriate transform.
+static void ResetVertexAttributes(
+    RawVertex& vertex,
+    const int keep,
+    const RawVertex& defaultVertex) {
+  if ((keep & RAW_VERTEX_ATTRIBUTE_POSITION) == 0) {
+    vertex.position = defaultVertex.position;
+  }
+  if ((keep & RAW_VERTEX_ATTRIBUTE_NORMAL) == 0) {
+    vertex.normal = defaultVertex.normal;
+  }
+  if ((keep & RAW_VERTEX_ATTRIBUTE_TANGENT) == 0) {
+    vertex.tangent = defaultVertex.tangent;
+  }
+  if ((keep & RAW_VERTEX_ATTRIBUTE_BINORMAL) == 0) {
+    vertex.binormal = defaultVertex.binormal;
+  }
+  if ((keep & RAW_VERTEX_ATTRIBUTE_COLOR) == 0) {
+    vertex.color = defaultVertex.color;
+  }
+  if ((keep & RAW_VERTEX_ATTRIBUTE_UV0) == 0) {
+    vertex.uv0 = defaultVertex.uv0;
+  }
+  if ((keep & RAW_VERTEX_ATTRIBUTE_UV1) == 0) {
+    vertex.uv1 = defaultVertex.uv1;
+  }
+  if ((keep & RAW_VERTEX_ATTRIBUTE_JOINT_INDICES) == 0) {
+    vertex.jointIndices = defaultVertex.jointIndices;
+  }
+  if ((keep & RAW_VERTEX_ATTRIBUTE_JOINT_WEIGHTS) == 0) {
+    vertex.jointWeights = defaultVertex.jointWeights;
+  }
+}
+
+void RawModel::CreateMaterialModels(
+    std::vector<RawModel>& materialModels,
+    bool shortIndices,
+    const int keepAttribs,
+    const bool forceDiscrete) const {
+  // Split the triangles into opaque and transparent triangles. Triangles without a material or
+  // surface never make it into a model.
+  std::vector<int> opaqueTriangles;
+  std::vector<int> transparentTriangles;
+  for (int triangleIndex = 0; triangleIndex < (int)triangles.size(); triangleIndex++) {
+    const RawTriangle& triangle = triangles[triangleIndex];
+    if (triangle.materialIndex < 0 || triangle.surfaceIndex < 0) {
+      continue;
+    }
+    const int textureIndex = materials[triangle.materialIndex].textures[RAW_TEXTURE_USAGE_DIFFUSE];
+    if (textureIndex < 0) {
+      if (vertices[triangle.verts[0]].color.w < 1.0f ||
+          vertices[triangle.verts[1]].color.w < 1.0f ||
+          vertices[triangle.verts[2]].color.w < 1.0f) {
+        transparentTriangles.push_back(triangleIndex);
+        continue;
+      }
+      opaqueTriangles.push_back(triangleIndex);
+      continue;
+    }
+    if (textures[textureIndex].occlusion == RAW_TEXTURE_OCCLUSION_TRANSPARENT) {
+      transparentTriangles.push_back(triangleIndex);
+    } else {
+      opaqueTriangles.push_back(triangleIndex);
+    }
+  }
 
-    const int prevSurfaceCount = model->GetSurfaceCount();
-    const int materialIndex = model->AddMaterial(materials[sortedTriangles[i].materialIndex]);
-    const int surfaceIndex = model->AddSurface(surfaces[sortedTriangles[i].surfaceIndex]);
-    RawSurface& rawSurface = model->GetSurface(surfaceIndex);
+  // Sort the triangles based on material first, then surface, then first vertex index, which
+  // for the transparent triangles goes in the reverse direction: one stable counting sort per
+  // key, least significant first.
+  std::vector<int> scratch;
+  const int vertexCount = (int)vertices.size();
+  CountingSort(opaqueTriangles, scratch, vertices.size(), [&](int triangleIndex) {
+    return triangles[triangleIndex].verts[0];
+  });
+  CountingSort(transparentTriangles, scratch, vertices.size(), [&](int triangleIndex) {
+    return vertexCount - 1 - triangles[triangleIndex].verts[0];
+  });
+  for (std::vector<int>* sorted : {&opaqueTriangles, &transparentTriangles}) {
+    CountingSort(*sorted, scratch, surfaces.size(), [&](int triangleIndex) {
+      return triangles[triangleIndex].surfaceIndex;
+    });
+    CountingSort(*sorted, scratch, materials.size(), [&](int triangleIndex) {
+      return triangles[triangleIndex].materialIndex;
+    });
+  }
+  std::vector<int>& sortedTriangles = opaqueTriangles;
+  sortedTriangles.insert(
+      sortedTriangles.end(), transparentTriangles.begin(), transparentTriangles.end());
 
-    if (model->GetSurfaceCount() > prevSurfaceCount) {
-      const std::vector<long>& jointIds = surfaces[sortedTriangles[i].surfaceIndex].jointIds;
-      for (const auto& jointId : jointIds) {
-        const int nodeIndex = GetNodeById(jointId);
-        assert(nodeIndex != -1);
-        model->AddNode(GetNode(nodeIndex));
+  // Find the runs of triangles that share a model, short of splitting them up for 16-bit
+  // indices: one per material, and one per surface where surfaces are discrete.
+  std::vector<std::pair<size_t, size_t>> modelGroups;
+  for (size_t i = 0; i < sortedTriangles.size(); i++) {
+    const RawTriangle& triangle = triangles[sortedTriangles[i]];
+    if (i == 0) {
+      modelGroups.emplace_back(i, i);
+    } else {
+      const RawTriangle& previous = triangles[sortedTriangles[i - 1]];
+      if (triangle.materialIndex != previous.materialIndex ||
+          (triangle.surfaceIndex != previous.surfaceIndex &&
+           (forceDiscrete || surfaces[triangle.surfaceIndex].discrete ||
+            surfaces[previous.surfaceIndex].discrete))) {
+        modelGroups.emplace_back(i, i);
       }
-      rawSurface.bounds.Clear();
     }
+    modelGroups.back().second = i + 1;
+  }
 
-    int verts[3];
-    for (int j = 0; j < 3; j++) {
-      RawVertex vertex = vertices[sortedTriangles[i].verts[j]];
+  const RawVertex defaultVertex;
 
-      if (keepAttribs != -1) {
-        int keep = keepAttribs;
-        if ((keepAttribs & RAW_VERTEX_ATTRIBUTE_POSITION) != 0) {
-          keep |= RAW_VERTEX_ATTRIBUTE_JOINT_INDICES | RAW_VERTEX_ATTRIBUTE_JOINT_WEIGHTS;
+  // The groups share nothing, so their models are built concurrently. Each group maps our vertex
+  // indices to those of the model it is building; vertices can be shared between groups, and the
+  // map only holds the group's own vertices, so memory stays proportional to the output.
+  std::vector<std::vector<RawModel>> groupModels(modelGroups.size());
+  ThreadUtils::ParallelForEach(modelGroups.size(), [&](size_t groupIndex, size_t) {
+    std::unordered_map<int, int> vertexRemap;
+
+    // The surfaces were copied with their blend deltas indexing our vertices; move them over to
+    // the model's own vertex indices, then clear the map for the next model.
+    const auto finishModel = [&](RawModel& model) {
+      for (auto& surface : model.surfaces) {
+        RemapBlendChannels(surface, [&](int oldIndex) {
+          const auto it = vertexRemap.find(oldIndex);
+          return (it != vertexRemap.end()) ? it->second : -1;
+        });
+      }
+      vertexRemap.clear();
+    };
+
+    const size_t groupBegin = modelGroups[groupIndex].first;
+    const size_t groupEnd = modelGroups[groupIndex].second;
+    const int keep = (keepAttribs != -1)
+        ? GetKeptVertexAttributes(
+              keepAttribs, materials[triangles[sortedTriangles[groupBegin]].materialIndex])
+        : -1;
+
+    std::vector<RawModel>& models = groupModels[groupIndex];
+    RawModel* model = nullptr;
+    for (size_t i = groupBegin; i < groupEnd; i++) {
+      const RawTriangle& triangle = triangles[sortedTriangles[i]];
+
+      if (model == nullptr || (shortIndices && model->GetVertexCount() >= 0xFFFE)) {
+        if (model != nullptr) {
+          finishModel(*model);
         }
-        if ((keepAttribs & RAW_VERTEX_ATTRIBUTE_AUTO) != 0) {
-          keep |= RAW_VERTEX_ATTRIBUTE_POSITION;
+        models.resize(models.size() + 1);
+        model = &models.back();
+        model->globalMaxWeights = globalMaxWeights;
+      }
 
-          const RawMaterial& mat = model->GetMaterial(materialIndex);
-          if (mat.textures[RAW_TEXTURE_USAGE_DIFFUSE] != -1) {
-            keep |= RAW_VERTEX_ATTRIBUTE_UV0;
-          }
-          if (mat.textures[RAW_TEXTURE_USAGE_NORMAL] != -1) {
-            keep |= RAW_VERTEX_ATTRIBUTE_NORMAL | RAW_VERTEX_ATTRIBUTE_TANGENT |
-                RAW_VERTEX_ATTRIBUTE_BINORMAL | RAW_VERTEX_ATTRIBUTE_UV0;
-          }
-          if (mat.textures[RAW_TEXTURE_USAGE_SPECULAR] != -1) {
-            keep |= RAW_VERTEX_ATTRIBUTE_NORMAL | RAW_VERTEX_ATTRIBUTE_UV0;
-          }
-          if (mat.textures[RAW_TEXTURE_USAGE_EMISSIVE] != -1) {
-            keep |= RAW_VERTEX_ATTRIBUTE_UV1;
-          }
-        }
-        if ((keep & RAW_VERTEX_ATTRIBUTE_POSITION) == 0) {
-          vertex.position = defaultVertex.position;
-        }
-        if ((keep & RAW_VERTEX_ATTRIBUTE_NORMAL) == 0) {
-          vertex.normal = defaultVertex.normal;
-        }
-        if ((keep & RAW_VERTEX_ATTRIBUTE_TANGENT) == 0) {
-          vertex.tangent = defaultVertex.tangent;
-        }
-        if ((keep & RAW_VERTEX_ATTRIBUTE_BINORMAL) == 0) {
-          vertex.binormal = defaultVertex.binormal;
-        }
-        if ((keep & RAW_VERTEX_ATTRIBUTE_COLOR) == 0) {
-          vertex.color = defaultVertex.color;
-        }
-        if ((keep & RAW_VERTEX_ATTRIBUTE_UV0) == 0) {
-          vertex.uv0 = defaultVertex.uv0;
-        }
-        if ((keep & RAW_VERTEX_ATTRIBUTE_UV1) == 0) {
-          vertex.uv1 = defaultVertex.uv1;
-        }
-        if ((keep & RAW_VERTEX_ATTRIBUTE_JOINT_INDICES) == 0) {
-          vertex.jointIndices = defaultVertex.jointIndices;
-        }
-        if ((keep & RAW_VERTEX_ATTRIBUTE_JOINT_WEIGHTS) == 0) {
-          vertex.jointWeights = defaultVertex.jointWeights;
+      // FIXME: will have to unlink from the nodes, transform both surfaces into a
+      // common space, and reparent to a new node with appropriate transform.
+
+      const int prevSurfaceCount = model->GetSurfaceCount();
+      const int materialIndex = model->AddMaterial(materials[triangle.materialIndex]);
+      const int surfaceIndex = model->AddSurface(surfaces[triangle.surfaceIndex]);
+      RawSurface& rawSurface = model->GetSurface(surfaceIndex);
+
+      if (model->GetSurfaceCount() > prevSurfaceCount) {
+        const std::vector<long>& jointIds = surfaces[triangle.surfaceIndex].jointIds;
+        for (const auto& jointId : jointIds) {
+          const int nodeIndex = GetNodeById(jointId);
+          assert(nodeIndex != -1);
+          model->AddNode(GetNode(nodeIndex));
         }
+        rawSurface.bounds.Clear();
       }
 
-      verts[j] = model->AddVertex(vertex);
-      model->vertexAttributes |= vertex.Difference(defaultVertex);
+      int verts[3];
+      for (int j = 0; j < 3; j++) {
+        const int oldIndex = triangle.verts[j];
+        const auto inserted = vertexRemap.emplace(oldIndex, -1);
+        if (inserted.second) {
+          RawVertex vertex = vertices[oldIndex];
+          if (keepAttribs != -1) {
+            ResetVertexAttributes(vertex, keep, defaultVertex);
+          }
+          inserted.first->second = model->AddVertex(vertex);
+          model->vertexAttributes |= vertex.Difference(defaultVertex);
+        }
+        verts[j] = inserted.first->second;
+
+        rawSurface.bounds.AddPoint(model->vertices[verts[j]].position);
+      }
 
-      rawSurface.bounds.AddPoint(vertex.position);
+      model->AddTriangle(verts[0], verts[1], verts[2], materialIndex, surfaceIndex);
     }
+    finishModel(*model);
+  });
 
-    model->AddTriangle(verts[0], verts[1], verts[2], materialIndex, surfaceIndex);
+  size_t modelCount = 0;
+  for (const auto& models : groupModels) {
+    modelCount += models.size();
+  }
+  materialModels.clear();
+  materialModels.reserve(modelCount);
+  for (auto& models : groupModels) {
+    for (auto& model : models) {
+      materialModels.push_back(std::move(model));
+    }
   }
 }
 
 int RawModel::GetNodeById(const long nodeId) const {
-  for (size_t i = 0; i < nodes.size(); i++) {
-    if (nodes[i].id == nodeId) {
-      return (int)i;
-    }
+  auto it = nodeIdToIndex.find(nodeId);
+  if (it != nodeIdToIndex.end()) {
+    return it->second;
   }
   return -1;
 }
 
+const std::vector<Vec3f>* RawVertexStreams::Get(const Vec3f RawVertex::*ptr) const {
+  if (ptr == &RawVertex::position) {
+    return &position;
+  }
+  if (ptr == &RawVertex::normal) {
+    return &normal;
+  }
+  if (ptr == &RawVertex::binormal) {
+    return &binormal;
+  }
+  return nullptr;
+}
+
+const std::vector<Vec4f>* RawVertexStreams::Get(const Vec4f RawVertex::*ptr) const {
+  if (ptr == &RawVertex::tangent) {
+    return &tangent;
+  }
+  if (ptr == &RawVertex::color) {
+    return &color;
+  }
+  return nullptr;
+}
+
+const std::vector<Vec2f>* RawVertexStreams::Get(const Vec2f RawVertex::*ptr) const {
+  if (ptr == &RawVertex::uv0) {
+    return &uv0;
+  }
+  if (ptr == &RawVertex::uv1) {
+    return &uv1;
+  }
+  return nullptr;
+}
+
+const std::vector<Vec4i>* RawVertexStreams::Get(
+    const RawJointArray<Vec4i> RawVertex::*ptr,
+    const int arrayOffset) const {
+  if (ptr == &RawVertex::jointIndices && arrayOffset < (int)jointIndices.size()) {
+    return &jointIndices[arrayOffset];
+  }
+  return nullptr;
+}
+
+const std::vector<Vec4f>* RawVertexStreams::Get(
+    const RawJointArray<Vec4f> RawVertex::*ptr,
+    const int arrayOffset) const {
+  if (ptr == &RawVertex::jointWeights && arrayOffset < (int)jointWeights.size()) {
+    return &jointWeights[arrayOffset];
+  }
+  return nullptr;
+}
+
+void RawModel::BuildVertexStreams() {
+  ReleaseVertexStreams();
+
+  const size_t count = vertices.size();
+  vertexStreams.count = count;
+  const bool hasPosition = (vertexAttributes & RAW_VERTEX_ATTRIBUTE_POSITION) != 0;
+  const bool hasNormal = (vertexAttributes & RAW_VERTEX_ATTRIBUTE_NORMAL) != 0;
+  const bool hasBinormal = (vertexAttributes & RAW_VERTEX_ATTRIBUTE_BINORMAL) != 0;
+  const bool hasTangent = (vertexAttributes & RAW_VERTEX_ATTRIBUTE_TANGENT) != 0;
+  const bool hasColor = (vertexAttributes & RAW_VERTEX_ATTRIBUTE_COLOR) != 0;
+  const bool hasUv0 = (vertexAttributes & RAW_VERTEX_ATTRIBUTE_UV0) != 0;
+  const bool hasUv1 = (vertexAttributes & RAW_VERTEX_ATTRIBUTE_UV1) != 0;
+  const size_t jointIndexGroups = (vertexAttributes & RAW_VERTEX_ATTRIBUTE_JOINT_INDICES) != 0
+      ? (size_t)(globalMaxWeights + 3) / 4
+      : 0;
+  const size_t jointWeightGroups = (vertexAttributes & RAW_VERTEX_ATTRIBUTE_JOINT_WEIGHTS) != 0
+      ? (size_t)(globalMaxWeights + 3) / 4
+      : 0;
+
+  vertexStreams.position.resize(hasPosition ? count : 0);
+  vertexStreams.normal.resize(hasNormal ? count : 0);
+  vertexStreams.binormal.resize(hasBinormal ? count : 0);
+  vertexStreams.tangent.resize(hasTangent ? count : 0);
+  vertexStreams.color.resize(hasColor ? count : 0);
+  vertexStreams.uv0.resize(hasUv0 ? count : 0);
+  vertexStreams.uv1.resize(hasUv1 ? count : 0);
+  vertexStreams.jointIndices.resize(jointIndexGroups, std::vector<Vec4i>(count));
+  vertexStreams.jointWeights.resize(jointWeightGroups, std::vector<Vec4f>(count));
+
+  // a single sweep over the fat vertex structs fills every stream
+  for (size_t i = 0; i < count; i++) {
+    const RawVertex& vertex = vertices[i];
+    if (hasPosition) {
+      vertexStreams.position[i] = vertex.position;
+    }
+    if (hasNormal) {
+      vertexStreams.normal[i] = vertex.normal;
+    }
+    if (hasBinormal) {
+      vertexStreams.binormal[i] = vertex.binormal;
+    }
+    if (hasTangent) {
+      vertexStreams.tangent[i] = vertex.tangent;
+    }
+    if (hasColor) {
+      vertexStreams.color[i] = vertex.color;
+    }
+    if (hasUv0) {
+      vertexStreams.uv0[i] = vertex.uv0;
+    }
+    if (hasUv1) {
+      vertexStreams.uv1[i] = vertex.uv1;
+    }
+    for (size_t group = 0; group < jointIndexGroups && group < vertex.jointIndices.size();
+         group++) {
+      vertexStreams.jointIndices[group][i] = vertex.jointIndices[group];
+    }
+    for (size_t group = 0; group < jointWeightGroups && group < vertex.jointWeights.size();
+         group++) {
+      vertexStreams.jointWeights[group][i] = vertex.jointWeights[group];
+    }
+  }
+}
+
+void RawModel::ReleaseVertexStreams() {
+  if (vertexStreams.count != 0) {
+    vertexStreams = RawVertexStreams();
+  }
+}
+
+size_t RawModel::GetVertexHashCollisionCount() const {
+  const VertexHasher hasher;
+  std::vector<std::pair<size_t, int>> hashes(vertices.size());
+  for (size_t i = 0; i < vertices.size(); i++) {
+    hashes[i] = std::make_pair(hasher(vertices[i]), (int)i);
+  }
+  std::sort(hashes.begin(), hashes.end());
+
+  // Within each run of equal hashes, count the vertices that differ from another member of the run.
+  size_t collisions = 0;
+  for (size_t begin = 0, end; begin < hashes.size(); begin = end) {
+    for (end = begin + 1; end < hashes.size() && hashes[end].first == hashes[begin].first; end++) {
+    }
+    for (size_t i = begin; i < end; i++) {
+      for (size_t j = begin; j < end; j++) {
+        if (!(vertices[hashes[i].second] == vertices[hashes[j].second])) {
+          collisions++;
+          break;
+        }
+      }
+    }
+  }
+  return collisions;
+}
+
 int RawModel::GetSurfaceById(const long surfaceId) const {
   for (size_t i = 0; i < surfaces.size(); i++) {
     if (surfaces[i].id == surfaceId) {
@@ -791,31 +1663,71 @@ int RawModel::GetSurfaceById(const long surfaceId) const {
   return -1;
 }
 
-Vec3f RawModel::getFaceNormal(int verts[3]) const {
-  const float l0 = (vertices[verts[1]].position - vertices[verts[0]].position).LengthSquared();
-  const float l1 = (vertices[verts[2]].position - vertices[verts[1]].position).LengthSquared();
-  const float l2 = (vertices[verts[0]].position - vertices[verts[2]].position).LengthSquared();
-  const int index = (l0 > l1) ? (l0 > l2 ? 2 : 1) : (l1 > l2 ? 0 : 1);
+// Computes the weighted face normal of each triangle: the normal at the corner opposite the
+// longest edge, scaled by half its squared cross product length and the acos of its edge dot
+// product. Corner positions are gathered into structure-of-arrays batches so that the cross
+// products and normalization compile to straight-line vector code; only acos stays scalar.
+static void CalculateFaceNormals(
+    const std::vector<RawVertex>& vertices,
+    const RawTriangle* triangles,
+    const size_t triangleCount,
+    Vec3f* faceNormals) {
+  const size_t BATCH_SIZE = 256;
+  float e0x[BATCH_SIZE], e0y[BATCH_SIZE], e0z[BATCH_SIZE];
+  float e1x[BATCH_SIZE], e1y[BATCH_SIZE], e1z[BATCH_SIZE];
+  float nx[BATCH_SIZE], ny[BATCH_SIZE], nz[BATCH_SIZE];
+  float edgeDot[BATCH_SIZE], scale[BATCH_SIZE];
+
+  for (size_t batchStart = 0; batchStart < triangleCount; batchStart += BATCH_SIZE) {
+    const size_t batchCount = std::min(BATCH_SIZE, triangleCount - batchStart);
+
+    for (size_t i = 0; i < batchCount; i++) {
+      const int* verts = triangles[batchStart + i].verts;
+      const Vec3f p[3] = {vertices[verts[0]].position,
+                          vertices[verts[1]].position,
+                          vertices[verts[2]].position};
+      const float l0 = (p[1] - p[0]).LengthSquared();
+      const float l1 = (p[2] - p[1]).LengthSquared();
+      const float l2 = (p[0] - p[2]).LengthSquared();
+      const int index = (l0 > l1) ? (l0 > l2 ? 2 : 1) : (l1 > l2 ? 0 : 1);
+      const Vec3f e0 = p[(index + 1) % 3] - p[index];
+      const Vec3f e1 = p[(index + 2) % 3] - p[index];
+      e0x[i] = e0.x;
+      e0y[i] = e0.y;
+      e0z[i] = e0.z;
+      e1x[i] = e1.x;
+      e1y[i] = e1.y;
+      e1z[i] = e1.z;
+    }
+
+    for (size_t i = 0; i < batchCount; i++) {
+      nx[i] = e0y[i] * e1z[i] - e0z[i] * e1y[i];
+      ny[i] = e0z[i] * e1x[i] - e0x[i] * e1z[i];
+      nz[i] = e0x[i] * e1y[i] - e0y[i] * e1x[i];
+      const float e0LengthSquared = e0x[i] * e0x[i] + e0y[i] * e0y[i] + e0z[i] * e0z[i];
+      const float e1LengthSquared = e1x[i] * e1x[i] + e1y[i] * e1y[i] + e1z[i] * e1z[i];
+      const float lengthSquared = nx[i] * nx[i] + ny[i] * ny[i] + nz[i] * nz[i];
+      const bool degenerate = e0LengthSquared < FLT_MIN || e1LengthSquared < FLT_MIN ||
+          lengthSquared < FLT_MIN;
+      const float dot = e0x[i] * e1x[i] + e0y[i] * e1y[i] + e0z[i] * e1z[i];
+      edgeDot[i] = std::max(-1.0f, std::min(1.0f, dot));
+      // normalized * area, with area = lengthSquared / 2
+      scale[i] = degenerate ? 0.0f
+                            : 0.5f * lengthSquared / std::sqrt(std::max(lengthSquared, FLT_MIN));
+    }
 
-  const Vec3f e0 = vertices[verts[(index + 1) % 3]].position - vertices[verts[index]].position;
-  const Vec3f e1 = vertices[verts[(index + 2) % 3]].position - vertices[verts[index]].position;
-  if (e0.LengthSquared() < FLT_MIN || e1.LengthSquared() < FLT_MIN) {
-    return Vec3f{0.0f};
-  }
-  auto result = Vec3f::CrossProduct(e0, e1);
-  auto resultLengthSquared = result.LengthSquared();
-  if (resultLengthSquared < FLT_MIN) {
-    return Vec3f{0.0f};
+    for (size_t i = 0; i < batchCount; i++) {
+      const float weight = scale[i] * std::acos(edgeDot[i]);
+      faceNormals[batchStart + i] = Vec3f(nx[i] * weight, ny[i] * weight, nz[i] * weight);
+    }
   }
-  float edgeDot = std::max(-1.0f, std::min(1.0f, Vec3f::DotProduct(e0, e1)));
-  float angle = acos(edgeDot);
-  float area = resultLengthSquared / 2.0f;
-  return result.Normalized() * angle * area;
 }
 
 size_t RawModel::CalculateNormals(bool onlyBroken) {
+  ReleaseVertexStreams();
   Vec3f averagePos = Vec3f{0.0f};
-  std::set<int> brokenVerts;
+  std::vector<bool> brokenVerts(vertices.size(), false);
+  size_t brokenCount = 0;
   for (int vertIx = 0; vertIx < vertices.size(); vertIx++) {
     RawVertex& vertex = vertices[vertIx];
     averagePos += (vertex.position / (float)vertices.size());
@@ -823,40 +1735,46 @@ size_t RawModel::CalculateNormals(bool onlyBroken) {
       continue;
     }
     vertex.normal = Vec3f{0.0f};
-    if (onlyBroken) {
-      brokenVerts.emplace(vertIx);
-    }
+    brokenVerts[vertIx] = true;
+    brokenCount++;
   }
 
-  for (auto& triangle : triangles) {
-    bool relevant = false;
-    for (int vertIx : triangle.verts) {
-      relevant |= (brokenVerts.count(vertIx) > 0);
-    }
-    if (!relevant) {
-      continue;
-    }
-    Vec3f faceNormal = this->getFaceNormal(triangle.verts);
-    for (int vertIx : triangle.verts) {
-      if (!onlyBroken || brokenVerts.count(vertIx) > 0) {
-        vertices[vertIx].normal += faceNormal;
+  // Face normals are computed in parallel a block at a time, then summed into the vertices in
+  // triangle order, so the result does not depend on the number of threads.
+  const size_t BLOCK_SIZE = 1 << 20;
+  std::vector<Vec3f> faceNormals;
+  for (size_t blockStart = 0; brokenCount > 0 && blockStart < triangles.size();
+       blockStart += BLOCK_SIZE) {
+    const size_t blockCount = std::min(BLOCK_SIZE, triangles.size() - blockStart);
+    faceNormals.resize(blockCount);
+    ThreadUtils::ParallelFor(blockCount, 4096, [&](size_t begin, size_t end, size_t) {
+      CalculateFaceNormals(
+          vertices, &triangles[blockStart + begin], end - begin, &faceNormals[begin]);
+    });
+    for (size_t i = 0; i < blockCount; i++) {
+      for (int vertIx : triangles[blockStart + i].verts) {
+        if (brokenVerts[vertIx]) {
+          vertices[vertIx].normal += faceNormals[i];
+        }
       }
     }
   }
 
-  for (int vertIx = 0; vertIx < vertices.size(); vertIx++) {
-    if (onlyBroken && brokenVerts.count(vertIx) == 0) {
-      continue;
-    }
-    RawVertex& vertex = vertices[vertIx];
-    if (vertex.normal.LengthSquared() < FLT_MIN) {
-      vertex.normal = vertex.position - averagePos;
-      if (vertex.normal.LengthSquared() < FLT_MIN) {
-        vertex.normal = Vec3f{0.0f, 1.0f, 0.0f};
+  ThreadUtils::ParallelFor(vertices.size(), 16384, [&](size_t begin, size_t end, size_t) {
+    for (size_t vertIx = begin; vertIx < end; vertIx++) {
+      if (!brokenVerts[vertIx]) {
         continue;
       }
+      RawVertex& vertex = vertices[vertIx];
+      if (vertex.normal.LengthSquared() < FLT_MIN) {
+        vertex.normal = vertex.position - averagePos;
+        if (vertex.normal.LengthSquared() < FLT_MIN) {
+          vertex.normal = Vec3f{0.0f, 1.0f, 0.0f};
+          continue;
+        }
+      }
+      vertex.normal.Normalize();
     }
-    vertex.normal.Normalize();
-  }
-  return onlyBroken ? brokenVerts.size() : vertices.size();
+  });
+  return brokenCount;
 }
@@ -8,9 +8,11 @@
 
 #pragma once
 
+#include <algorithm>
 #include <functional>
 #include <set>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
 
 #include "FBX2glTF.h"
@@ -39,6 +41,137 @@ struct RawBlendVertex {
   }
 };
 
+/**
+ * A vector-like container that keeps its first N elements inline, so the common case needs no
+ * heap allocation and copies as a flat block. It spills to the heap if it ever grows beyond N.
+ * Only the subset of std::vector that the raw model needs is provided.
+ */
+template <typename T, int N>
+class RawInlineVector {
+ public:
+  RawInlineVector() : heap(nullptr), count(0), capacity(N) {}
+  RawInlineVector(const RawInlineVector& other) : RawInlineVector() {
+    *this = other;
+  }
+  RawInlineVector(RawInlineVector&& other) noexcept : RawInlineVector() {
+    *this = std::move(other);
+  }
+  ~RawInlineVector() {
+    delete[] heap;
+  }
+
+  RawInlineVector& operator=(const RawInlineVector& other) {
+    if (this != &other) {
+      clear();
+      reserve(other.count);
+      std::copy(other.begin(), other.end(), data());
+      count = other.count;
+    }
+    return *this;
+  }
+  // Never allocates: spilled storage is stolen, and inline elements fit in either side's capacity.
+  RawInlineVector& operator=(RawInlineVector&& other) noexcept {
+    if (this != &other) {
+      if (other.heap != nullptr) {
+        delete[] heap;
+        heap = other.heap;
+        capacity = other.capacity;
+        count = other.count;
+        other.heap = nullptr;
+        other.capacity = N;
+        other.count = 0;
+      } else {
+        std::copy(other.begin(), other.end(), data());
+        count = other.count;
+      }
+    }
+    return *this;
+  }
+
+  bool operator==(const RawInlineVector& other) const {
+    return count == other.count && std::equal(begin(), end(), other.begin());
+  }
+  bool operator!=(const RawInlineVector& other) const {
+    return !(*this == other);
+  }
+
+  size_t size() const {
+    return count;
+  }
+  bool empty() const {
+    return count == 0;
+  }
+  void clear() {
+    count = 0;
+  }
+
+  T* data() {
+    return heap != nullptr ? heap : inlineData;
+  }
+  const T* data() const {
+    return heap != nullptr ? heap : inlineData;
+  }
+  T* begin() {
+    return data();
+  }
+  T* end() {
+    return data() + count;
+  }
+  const T* begin() const {
+    return data();
+  }
+  const T* end() const {
+    return data() + count;
+  }
+  T& operator[](const size_t index) {
+    return data()[index];
+  }
+  const T& operator[](const size_t index) const {
+    return data()[index];
+  }
+
+  void reserve(const size_t newCapacity) {
+    if (newCapacity <= capacity) {
+      return;
+    }
+    T* newHeap = new T[newCapacity];
+    std::copy(begin(), end(), newHeap);
+    delete[] heap;
+    heap = newHeap;
+    capacity = (uint32_t)newCapacity;
+  }
+  void resize(const size_t newCount) {
+    reserve(newCount);
+    for (size_t i = count; i < newCount; i++) {
+      data()[i] = T();
+    }
+    count = (uint32_t)newCount;
+  }
+  void push_back(const T& value) {
+    if (count == capacity) {
+      // value may refer to one of our own elements, which reserve() is about to free
+      const T copy = value;
+      reserve(capacity * 2);
+      data()[count++] = copy;
+      return;
+    }
+    data()[count++] = value;
+  }
+
+ private:
+  T inlineData[N];
+  T* heap;
+  uint32_t count;
+  uint32_t capacity;
+};
+
+// The default --skinning-weights; vertices with at most this many influences never allocate.
+const int RAW_INLINE_SKINNING_WEIGHTS = 8;
+
+// Skinning data is exported in groups of four influences (JOINTS_n / WEIGHTS_n).
+template <typename T>
+using RawJointArray = RawInlineVector<T, RAW_INLINE_SKINNING_WEIGHTS / 4>;
+
 struct RawVertexSkinningInfo
 {
   int jointIndex;
@@ -49,6 +182,8 @@ struct RawVertexSkinningInfo
   }
 };
 
+typedef RawInlineVector<RawVertexSkinningInfo, RAW_INLINE_SKINNING_WEIGHTS> RawVertexSkinningArray;
+
 struct RawVertex {
   Vec3f position{0.0f};
   Vec3f normal{0.0f};
@@ -57,18 +192,21 @@ struct RawVertex {
   Vec4f color{0.0f};
   Vec2f uv0{0.0f};
   Vec2f uv1{0.0f};
-  std::vector<Vec4i> jointIndices;
-  std::vector<Vec4f> jointWeights;
-  
-  std::vector<RawVertexSkinningInfo> skinningInfo;
+  RawJointArray<Vec4i> jointIndices;
+  RawJointArray<Vec4f> jointWeights;
+
+  RawVertexSkinningArray skinningInfo;
   // end of members that directly correspond to vertex attributes
 
   // if this vertex participates in a blend shape setup, the surfaceIx of its dedicated mesh;
   // otherwise, -1
   int blendSurfaceIx = -1;
-  // the size of this vector is always identical to the size of the corresponding
-  // RawSurface.blendChannels
-  std::vector<RawBlendVertex> blends;
+  // if this vertex participates in a blend shape setup, the control point it was created from;
+  // its morph deltas live in the RawSurface.blendChannels of its surface. Otherwise, -1
+  int blendControlPointIx = -1;
+  // if the morph normals or tangents of its surface vary per polygon corner, which of the distinct
+  // sets of deltas seen at its control point this vertex carries; otherwise, -1
+  int blendDeltaSetIx = -1;
 
   bool polarityUv0 = false;
   bool pad1 = false;
@@ -80,6 +218,40 @@ struct RawVertex {
   size_t Difference(const RawVertex& other) const;
 };
 
+/**
+ * Structure-of-arrays copy of a model's vertices: one contiguous stream per vertex attribute the
+ * model carries (per its vertexAttributes), so accessors can be written without striding over
+ * whole RawVertex structs. Joint indices and weights get one stream per group of four.
+ */
+struct RawVertexStreams {
+  // the number of vertices the streams were built from; 0 if they have not been built
+  size_t count = 0;
+  std::vector<Vec3f> position;
+  std::vector<Vec3f> normal;
+  std::vector<Vec3f> binormal;
+  std::vector<Vec4f> tangent;
+  std::vector<Vec4f> color;
+  std::vector<Vec2f> uv0;
+  std::vector<Vec2f> uv1;
+  std::vector<std::vector<Vec4i>> jointIndices;
+  std::vector<std::vector<Vec4f>> jointWeights;
+
+  // Look up the stream backing a RawVertex member; nullptr if there isn't one.
+  const std::vector<Vec3f>* Get(const Vec3f RawVertex::*ptr) const;
+  const std::vector<Vec4f>* Get(const Vec4f RawVertex::*ptr) const;
+  const std::vector<Vec2f>* Get(const Vec2f RawVertex::*ptr) const;
+  const std::vector<Vec4i>* Get(const RawJointArray<Vec4i> RawVertex::*ptr, int arrayOffset) const;
+  const std::vector<Vec4f>* Get(const RawJointArray<Vec4f> RawVertex::*ptr, int arrayOffset) const;
+  template <typename T>
+  const std::vector<T>* Get(const T RawVertex::*ptr) const {
+    return nullptr;
+  }
+  template <typename T>
+  const std::vector<T>* Get(const RawJointArray<T> RawVertex::*ptr, int arrayOffset) const {
+    return nullptr;
+  }
+};
+
 class VertexHasher {
  public:
   size_t operator()(const RawVertex& v) const;
@@ -320,6 +492,15 @@ struct RawBlendChannel {
   bool hasNormals;
   bool hasTangents;
   std::string name;
+  // Sparse morph deltas: strictly increasing indices into the model's vertices, and the delta of
+  // each. Vertices that are not listed are not moved by this channel.
+  std::vector<int> vertexIndices;
+  std::vector<RawBlendVertex> deltas;
+
+  void AddDelta(const int vertexIndex, const RawBlendVertex& delta) {
+    vertexIndices.push_back(vertexIndex);
+    deltas.push_back(delta);
+  }
 };
 
 struct RawSurface {
@@ -336,12 +517,29 @@ struct RawSurface {
   int index = -1;
 };
 
+enum RawInterpolation {
+  RAW_INTERPOLATION_LINEAR,
+  RAW_INTERPOLATION_STEP,
+  // each sample is an in-tangent, a value and an out-tangent, in that order, as in glTF
+  RAW_INTERPOLATION_CUBICSPLINE
+};
+
 struct RawChannel {
   int nodeIndex;
   std::vector<Vec3f> translations;
   std::vector<Quatf> rotations;
   std::vector<Vec3f> scales;
   std::vector<float> weights;
+
+  // When not empty, the times of the translations, rotations or scales, which otherwise follow
+  // RawAnimation::times.
+  std::vector<float> translationTimes;
+  std::vector<float> rotationTimes;
+  std::vector<float> scaleTimes;
+
+  RawInterpolation translationInterpolation = RAW_INTERPOLATION_LINEAR;
+  RawInterpolation rotationInterpolation = RAW_INTERPOLATION_LINEAR;
+  RawInterpolation scaleInterpolation = RAW_INTERPOLATION_LINEAR;
 };
 
 struct RawAnimation {
@@ -458,6 +656,29 @@ class RawModel {
 
   void TransformTextures(const std::vector<std::function<Vec2f(Vec2f)>>& transforms);
 
+  // Lower the sampling rate of each baked translation, rotation and scale track, independently, as
+  // far as interpolation reproduces its samples within the given tolerances; the angle tolerance is
+  // in degrees.
+  void AdaptAnimationRates(
+      const float positionTolerance,
+      const float angleTolerance,
+      const float scaleTolerance);
+
+  // Drop the animation samples that interpolating between their neighbours reproduces within the
+  // given tolerances; the angle tolerance is in degrees.
+  void ReduceAnimations(
+      const float positionTolerance,
+      const float angleTolerance,
+      const float scaleTolerance);
+
+  // Drop the translation, rotation and scale tracks that are constant within the given tolerances,
+  // folding their value into the rest pose of nodes that no skin joint depends on; see
+  // RemoveConstantTracks().
+  void RemoveConstantAnimationTracks(
+      const float positionTolerance,
+      const float angleTolerance,
+      const float scaleTolerance);
+
   size_t CalculateNormals(bool);
 
   // Get the attributes stored per vertex.
@@ -477,6 +698,8 @@ class RawModel {
   const RawVertex& GetVertex(const int index) const {
     return vertices[index];
   }
+  // Number of distinct vertices whose hash is shared with some other distinct vertex.
+  size_t GetVertexHashCollisionCount() const;
 
   // Iterate over the triangles.
   int GetTriangleCount() const {
@@ -550,19 +773,26 @@ class RawModel {
   }
   int GetNodeById(const long nodeId) const;
 
-  // Create individual attribute arrays.
-  // Returns true if the vertices store the particular attribute.
+  // Split the vertices into one contiguous stream per attribute in vertexAttributes. This doubles
+  // the model's vertex memory, so build the streams right before writing accessors and release them
+  // right after. Any change to the vertices or their attributes discards the streams.
+  void BuildVertexStreams();
+  void ReleaseVertexStreams();
+
+  // Get an individual attribute array. If vertex streams have been built, this is the stream
+  // itself and nothing is copied; otherwise the attribute is gathered into 'scratch'.
   template <typename _attrib_type_>
-  void GetAttributeArray(std::vector<_attrib_type_>& out, const _attrib_type_ RawVertex::*ptr)
-      const;
+  const std::vector<_attrib_type_>& GetAttributeArray(
+      std::vector<_attrib_type_>& scratch,
+      const _attrib_type_ RawVertex::*ptr) const;
 
-  // Create individual attribute arrays, with the source as an array.
-  // Returns true if the vertices store the particular attribute.
+  // Get an individual attribute array, with the source as an array. Same stream semantics as
+  // GetAttributeArray().
   template <typename _attrib_type_>
-  void GetArrayAttributeArray(std::vector<_attrib_type_>& out, 
-    const std::vector<_attrib_type_> RawVertex::*ptr,
-    const int arrayOffset)
-    const;
+  const std::vector<_attrib_type_>& GetArrayAttributeArray(
+      std::vector<_attrib_type_>& scratch,
+      const RawJointArray<_attrib_type_> RawVertex::*ptr,
+      const int arrayOffset) const;
 
   // Create an array with a raw model for each material.
   // Multiple surfaces with the same material will turn into a single model.
@@ -576,15 +806,20 @@ class RawModel {
   bool forceMask = false;
 
  private:
-  Vec3f getFaceNormal(int verts[3]) const;
-
   long rootNodeId;
   int vertexAttributes;
   int globalMaxWeights;
-  std::unordered_map<RawVertex, int, VertexHasher> vertexHash;
+  // maps a VertexHasher hash to the indices of every vertex in 'vertices' that has it
+  std::unordered_multimap<size_t, int> vertexHash;
+  // maps a HashTextureKey/HashMaterialKey hash to the indices of the textures/materials having it
+  std::unordered_multimap<size_t, int> textureHash;
+  std::unordered_multimap<size_t, int> materialHash;
+  std::unordered_set<std::string> materialNames;
   std::unordered_map<long, size_t> materialIdToIndex;
   std::unordered_map<long, size_t> surfaceIdToIndex;
+  std::unordered_map<long, int> nodeIdToIndex;
   std::vector<RawVertex> vertices;
+  RawVertexStreams vertexStreams;
   std::vector<RawTriangle> triangles;
   std::vector<RawTexture> textures;
   std::vector<RawMaterial> materials;
@@ -596,22 +831,32 @@ class RawModel {
 };
 
 template <typename _attrib_type_>
-void RawModel::GetAttributeArray(
-    std::vector<_attrib_type_>& out,
+const std::vector<_attrib_type_>& RawModel::GetAttributeArray(
+    std::vector<_attrib_type_>& scratch,
     const _attrib_type_ RawVertex::*ptr) const {
-  out.resize(vertices.size());
+  const std::vector<_attrib_type_>* stream = vertexStreams.Get(ptr);
+  if (stream != nullptr && stream->size() == vertices.size()) {
+    return *stream;
+  }
+  scratch.resize(vertices.size());
   for (size_t i = 0; i < vertices.size(); i++) {
-    out[i] = vertices[i].*ptr;
+    scratch[i] = vertices[i].*ptr;
   }
+  return scratch;
 }
 
 template <typename _attrib_type_>
-void RawModel::GetArrayAttributeArray(
-  std::vector<_attrib_type_>& out,
-  const std::vector<_attrib_type_> RawVertex::*ptr,
-  const int arrayOffset) const {
-  out.resize(vertices.size());
+const std::vector<_attrib_type_>& RawModel::GetArrayAttributeArray(
+    std::vector<_attrib_type_>& scratch,
+    const RawJointArray<_attrib_type_> RawVertex::*ptr,
+    const int arrayOffset) const {
+  const std::vector<_attrib_type_>* stream = vertexStreams.Get(ptr, arrayOffset);
+  if (stream != nullptr && stream->size() == vertices.size()) {
+    return *stream;
+  }
+  scratch.resize(vertices.size());
   for (size_t i = 0; i < vertices.size(); i++) {
-    out[i] = (vertices[i].*ptr)[arrayOffset];
+    scratch[i] = (vertices[i].*ptr)[arrayOffset];
   }
+  return scratch;
 }
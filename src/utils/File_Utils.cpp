@@ -44,6 +44,79 @@ std::vector<std::string> ListFolderFiles(
   return fileList;
 }
 
+FolderIndex::FolderIndex(
+    const std::string& folder,
+    const std::set<std::string>& matchExtensions,
+    const bool recursive)
+    : fileCount(0) {
+  if (!FolderExists(folder)) {
+    return;
+  }
+  const auto addFile = [&](const boost::filesystem::path& path, const int depth) {
+    const auto& suffix = FileUtils::GetFileSuffix(path.string());
+    if (!suffix.has_value() ||
+        matchExtensions.find(StringUtils::ToLower(suffix.value())) == matchExtensions.end()) {
+      return;
+    }
+    AddEntry(entriesByName, StringUtils::ToLower(path.filename().string()), path.string(), depth);
+    AddEntry(entriesByBase, StringUtils::ToLower(path.stem().string()), path.string(), depth);
+    fileCount++;
+  };
+
+  boost::system::error_code error;
+  if (recursive) {
+    boost::filesystem::recursive_directory_iterator it(
+        folder, boost::filesystem::symlink_option::none, error),
+        end;
+    for (; !error && it != end; it.increment(error)) {
+      addFile(it->path(), it.depth());
+      if (boost::filesystem::is_directory(it->symlink_status())) {
+        // failing to descend into a folder we may not read would end the whole scan
+        boost::system::error_code probeError;
+        boost::filesystem::directory_iterator probe(it->path(), probeError);
+        if (probeError == boost::system::errc::permission_denied) {
+          it.no_push();
+        }
+      }
+    }
+  } else {
+    boost::filesystem::directory_iterator it(folder, error), end;
+    for (; !error && it != end; it.increment(error)) {
+      addFile(it->path(), 0);
+    }
+  }
+  if (error) {
+    fmt::printf("Warning: Stopped listing %s early: %s\n", folder, error.message());
+  }
+}
+
+void FolderIndex::AddEntry(
+    std::unordered_map<std::string, Entry>& entries,
+    const std::string& key,
+    const std::string& path,
+    const int depth) {
+  auto it = entries.find(key);
+  if (it == entries.end()) {
+    entries.emplace(key, Entry{path, depth});
+  } else if (depth < it->second.depth || (depth == it->second.depth && path < it->second.path)) {
+    it->second = Entry{path, depth};
+  }
+}
+
+std::string FolderIndex::FindLoosely(
+    const std::string& lowerFileName,
+    const std::string& lowerFileBase) const {
+  auto it = entriesByName.find(lowerFileName);
+  if (it != entriesByName.end()) {
+    return it->second.path;
+  }
+  it = entriesByBase.find(lowerFileBase);
+  if (it != entriesByBase.end()) {
+    return it->second.path;
+  }
+  return "";
+}
+
 bool CreatePath(const std::string path) {
   const auto& parent = boost::filesystem::path(path).parent_path();
   if (parent.empty()) {
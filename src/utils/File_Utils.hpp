@@ -10,6 +10,7 @@
 
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/filesystem.hpp>
@@ -32,6 +33,41 @@ std::vector<std::string> ListFolderFiles(
 
 bool CreatePath(std::string path);
 
+// A case-insensitive index of the files in a folder, and optionally all of its subfolders, that
+// have one of the given extensions; both by file name and by file name without extension. Where
+// several files share a name, the one closest to the top of the folder wins, then the first by
+// path.
+class FolderIndex {
+ public:
+  FolderIndex(
+      const std::string& folder,
+      const std::set<std::string>& matchExtensions,
+      const bool recursive);
+
+  // The path of the file called lowerFileName or, failing that, of a file with the base name
+  // lowerFileBase; empty if there is neither. Both arguments must already be in lower case.
+  std::string FindLoosely(const std::string& lowerFileName, const std::string& lowerFileBase) const;
+
+  size_t GetFileCount() const {
+    return fileCount;
+  }
+
+ private:
+  struct Entry {
+    std::string path;
+    int depth;
+  };
+  static void AddEntry(
+      std::unordered_map<std::string, Entry>& entries,
+      const std::string& key,
+      const std::string& path,
+      const int depth);
+
+  std::unordered_map<std::string, Entry> entriesByName;
+  std::unordered_map<std::string, Entry> entriesByBase;
+  size_t fileCount;
+};
+
 bool CopyFile(
     const std::string& srcFilename,
     const std::string& dstFilename,
@@ -9,7 +9,16 @@
 #include "Image_Utils.hpp"
 
 #include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+
+#include "FBX2glTF.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 
@@ -21,34 +30,71 @@
 
 namespace ImageUtils {
 
+// Classifies RGBA pixels a block at a time. Most textures are fully opaque, and that is cheap to
+// confirm: the alpha byte of all of a block's pixels ANDed together is 255. Only other blocks are
+// looked at pixel by pixel, without branches, so that compilers can vectorise both loops; the scan
+// still stops at the first block with a translucent pixel.
+static ImageOcclusion classifyAlpha(const uint8_t* pixels, const size_t pixelCount) {
+  static const size_t PIXELS_PER_BLOCK = 64;
+
+  bool hasMaskTransparency = false;
+  size_t ix = 0;
+  for (; ix + PIXELS_PER_BLOCK <= pixelCount; ix += PIXELS_PER_BLOCK) {
+    const uint8_t* block = pixels + 4 * ix;
+    uint32_t words[PIXELS_PER_BLOCK];
+    memcpy(words, block, sizeof(words));
+    uint32_t allWords = ~0u;
+    for (size_t jx = 0; jx < PIXELS_PER_BLOCK; jx++) {
+      allWords &= words[jx];
+    }
+    uint8_t allBytes[4];
+    memcpy(allBytes, &allWords, sizeof(allBytes));
+    if (allBytes[3] == 255) {
+      continue;
+    }
+
+    uint8_t translucent = 0;
+    uint8_t transparent = 0;
+    for (size_t jx = 0; jx < PIXELS_PER_BLOCK; jx++) {
+      const uint8_t alpha = block[4 * jx + 3];
+      translucent |= (uint8_t)(alpha - 1) < 254; // 0 < alpha < 255
+      transparent |= alpha == 0;
+    }
+    if (translucent) {
+      return IMAGE_TRANSPARENT;
+    }
+    hasMaskTransparency |= (transparent != 0);
+  }
+  for (; ix < pixelCount; ix++) {
+    const uint8_t alpha = pixels[4 * ix + 3];
+    if (alpha < 255 && alpha > 0) {
+      return IMAGE_TRANSPARENT;
+    }
+    if (alpha == 0) {
+      hasMaskTransparency = true;
+    }
+  }
+  return hasMaskTransparency ? IMAGE_TRANSPARENT_MASK : IMAGE_OPAQUE;
+}
+
 static ImageOcclusion imageOcclusion(FILE* f) {
   int width, height, channels;
   // RGBA: we have to load the pixels to figure out if the image is fully opaque
-  uint8_t* pixels = stbi_load_from_file(f, &width, &height, &channels, 0);
-  bool hasMaskTransparency = false;
+  uint8_t* pixels = stbi_load_from_file(f, &width, &height, &channels, 4);
+  ImageOcclusion occlusion = IMAGE_OPAQUE;
   if (pixels != nullptr) {
-    int pixelCount = width * height;
-    for (int ix = 0; ix < pixelCount; ix++) {
-      uint8_t alpha = pixels[4 * ix + 3];
-      if (alpha < 255 && alpha > 0) {
-        stbi_image_free(pixels);
-        return IMAGE_TRANSPARENT;
-      }
-
-      if (alpha == 0) {
-        hasMaskTransparency = true;
-      }
-    }
+    occlusion = classifyAlpha(pixels, (size_t)width * (size_t)height);
   }
 
   stbi_image_free(pixels);
-  return hasMaskTransparency ? IMAGE_TRANSPARENT_MASK : IMAGE_OPAQUE;
+  return occlusion;
 }
 
-ImageProperties GetImageProperties(char const* filePath) {
+static ImageProperties ReadImageProperties(char const* filePath) {
   ImageProperties result = {
       1,
       1,
+      0,
       IMAGE_OPAQUE,
   };
 
@@ -57,15 +103,123 @@ ImageProperties GetImageProperties(char const* filePath) {
     return result;
   }
 
-  int channels;
-  int success = stbi_info_from_file(f, &result.width, &result.height, &channels);
+  int success = stbi_info_from_file(f, &result.width, &result.height, &result.channels);
 
-  if (success && channels == 4) {
+  if (success && result.channels == 4) {
     result.occlusion = imageOcclusion(f);
   }
+  fclose(f);
   return result;
 }
 
+struct CachedImageProperties {
+  uintmax_t fileSize;
+  std::time_t modificationTime;
+  ImageProperties properties;
+};
+
+static std::mutex propertiesCacheMutex;
+static std::unordered_map<std::string, CachedImageProperties> propertiesCache;
+static bool propertiesCacheChanged = false;
+
+static const char* const occlusionNames[] = {"opaque", "transparent", "mask"};
+
+ImageProperties GetImageProperties(char const* filePath) {
+  boost::system::error_code error;
+  const boost::filesystem::path path = boost::filesystem::absolute(filePath);
+  const uintmax_t fileSize = boost::filesystem::file_size(path, error);
+  const std::time_t modificationTime =
+      error ? 0 : boost::filesystem::last_write_time(path, error);
+  if (error) {
+    // no such file: not worth caching
+    return ReadImageProperties(filePath);
+  }
+
+  const std::string key = path.string();
+  {
+    std::lock_guard<std::mutex> lock(propertiesCacheMutex);
+    const auto it = propertiesCache.find(key);
+    if (it != propertiesCache.end() && it->second.fileSize == fileSize &&
+        it->second.modificationTime == modificationTime) {
+      return it->second.properties;
+    }
+  }
+
+  const ImageProperties result = ReadImageProperties(filePath);
+  std::lock_guard<std::mutex> lock(propertiesCacheMutex);
+  propertiesCache[key] = CachedImageProperties{fileSize, modificationTime, result};
+  propertiesCacheChanged = true;
+  return result;
+}
+
+bool LoadImagePropertiesCache(const std::string& cachePath) {
+  std::ifstream cacheFile(cachePath);
+  if (!cacheFile) {
+    return false;
+  }
+  json cache;
+  try {
+    cache = json::parse(cacheFile);
+  } catch (const std::exception& e) {
+    fmt::printf("Warning: Ignoring unreadable image cache %s: %s\n", cachePath, e.what());
+    return false;
+  }
+  if (!cache.is_object() || cache.value("version", 0) != 1 || !cache["images"].is_object()) {
+    fmt::printf("Warning: Ignoring image cache %s of an unknown format.\n", cachePath);
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(propertiesCacheMutex);
+  for (auto it = cache["images"].begin(); it != cache["images"].end(); ++it) {
+    const json& entry = it.value();
+    const std::string occlusionName = entry.value("occlusion", "");
+    const auto occlusion =
+        std::find(std::begin(occlusionNames), std::end(occlusionNames), occlusionName);
+    if (occlusion == std::end(occlusionNames)) {
+      continue;
+    }
+    CachedImageProperties& cached = propertiesCache[it.key()];
+    cached.fileSize = entry.value("size", (uintmax_t)0);
+    cached.modificationTime = entry.value("mtime", (std::time_t)0);
+    cached.properties.width = entry.value("width", 1);
+    cached.properties.height = entry.value("height", 1);
+    cached.properties.channels = entry.value("channels", 0);
+    cached.properties.occlusion = (ImageOcclusion)(occlusion - std::begin(occlusionNames));
+  }
+  if (verboseOutput) {
+    fmt::printf("Loaded %lu image properties from %s.\n", propertiesCache.size(), cachePath);
+  }
+  return true;
+}
+
+bool SaveImagePropertiesCache(const std::string& cachePath) {
+  std::lock_guard<std::mutex> lock(propertiesCacheMutex);
+  if (!propertiesCacheChanged) {
+    return true;
+  }
+  json images = json::object();
+  for (const auto& it : propertiesCache) {
+    const CachedImageProperties& cached = it.second;
+    images[it.first] = {
+        {"size", cached.fileSize},
+        {"mtime", cached.modificationTime},
+        {"width", cached.properties.width},
+        {"height", cached.properties.height},
+        {"channels", cached.properties.channels},
+        {"occlusion", occlusionNames[cached.properties.occlusion]},
+    };
+  }
+
+  std::ofstream cacheFile(cachePath, std::ios::trunc);
+  if (!cacheFile) {
+    fmt::printf("Warning: Couldn't write image cache %s.\n", cachePath);
+    return false;
+  }
+  cacheFile << json{{"version", 1}, {"images", images}}.dump();
+  propertiesCacheChanged = false;
+  return !cacheFile.fail();
+}
+
 std::string suffixToMimeType(std::string suffix) {
   std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
 
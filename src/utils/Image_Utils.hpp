@@ -21,11 +21,24 @@ enum ImageOcclusion {
 struct ImageProperties {
   int width;
   int height;
+  int channels;
   ImageOcclusion occlusion;
 };
 
+/**
+ * Classifying the alpha of an RGBA image means decoding all of it, so image properties are cached
+ * by absolute path: in memory for the whole run, and across runs in the file given to
+ * LoadImagePropertiesCache() and SaveImagePropertiesCache(). An entry is only used while the
+ * file's size and modification time remain the same.
+ */
 ImageProperties GetImageProperties(char const* filePath);
 
+// Adds the entries of a cache file written by SaveImagePropertiesCache(), if there is one.
+bool LoadImagePropertiesCache(const std::string& cachePath);
+
+// Writes out every entry known, unless nothing has changed since LoadImagePropertiesCache().
+bool SaveImagePropertiesCache(const std::string& cachePath);
+
 /**
  * Very simple method for mapping filename suffix to mime type. The glTF 2.0 spec only accepts
  * values "image/jpeg" and "image/png" so we don't need to get too fancy.
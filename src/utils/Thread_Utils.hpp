@@ -0,0 +1,76 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace ThreadUtils {
+
+inline size_t GetWorkerCount() {
+  const unsigned int count = std::thread::hardware_concurrency();
+  return count > 0 ? count : 1;
+}
+
+// Splits [0, count) into contiguous ranges, one per worker thread, and calls
+// fn(begin, end, workerIndex) for each of them; returns once every range is done. Runs on the
+// calling thread alone when there are fewer than 2 * minPerWorker items to go around.
+template <typename Fn>
+void ParallelFor(const size_t count, const size_t minPerWorker, const Fn& fn) {
+  const size_t workerCount =
+      std::max<size_t>(1, std::min(GetWorkerCount(), count / std::max<size_t>(1, minPerWorker)));
+  if (workerCount <= 1) {
+    if (count > 0) {
+      fn((size_t)0, count, (size_t)0);
+    }
+    return;
+  }
+
+  const size_t rangeSize = (count + workerCount - 1) / workerCount;
+  std::vector<std::thread> threads;
+  threads.reserve(workerCount - 1);
+  for (size_t workerIndex = 1; workerIndex < workerCount; workerIndex++) {
+    const size_t begin = workerIndex * rangeSize;
+    const size_t end = std::min(count, begin + rangeSize);
+    if (begin >= end) {
+      break;
+    }
+    threads.emplace_back([&fn, begin, end, workerIndex]() { fn(begin, end, workerIndex); });
+  }
+  fn((size_t)0, std::min(count, rangeSize), (size_t)0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// Calls fn(index, workerIndex) for every index in [0, count), handing the indices out to the worker
+// threads one at a time; suits items of very uneven cost. workerIndex is below GetWorkerCount().
+template <typename Fn>
+void ParallelForEach(const size_t count, const Fn& fn) {
+  std::atomic<size_t> nextIndex(0);
+  const auto work = [&fn, &nextIndex, count](const size_t workerIndex) {
+    for (size_t index = nextIndex++; index < count; index = nextIndex++) {
+      fn(index, workerIndex);
+    }
+  };
+
+  const size_t workerCount = std::min(GetWorkerCount(), count);
+  std::vector<std::thread> threads;
+  for (size_t workerIndex = 1; workerIndex < workerCount; workerIndex++) {
+    threads.emplace_back(work, workerIndex);
+  }
+  work(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+} // namespace ThreadUtils